@@ -0,0 +1,503 @@
+#pragma once
+#include <ncurses.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+#include "cellgrid.hpp"
+
+// Terminal output behind WindowManager::Flip. Present() receives the composed
+// screen grid whose dirty bits mark the cells changed since the last Present.
+struct ScreenBackend
+{
+    uint64_t u64BytesWritten = 0;
+    uint64_t u64Writes = 0;
+
+    virtual ~ScreenBackend() {}
+
+    virtual void Present(const CellGrid &cgScreen) = 0;
+
+    // forget what the terminal shows, the next Present repaints everything
+    virtual void Invalidate() = 0;
+};
+
+struct NcursesBackend : ScreenBackend
+{
+    WINDOW *p_wndScreen = nullptr;
+
+    NcursesBackend(WINDOW *p_wndScreen) : p_wndScreen(p_wndScreen) {}
+
+    void Present(const CellGrid &cgScreen) override
+    {
+        for (int y = 0; y < cgScreen.iLines; y++)
+        {
+            if (!cgScreen.IsRowDirty(y))
+                continue;
+
+            cgScreen.ForEachDirty(y, [&](int x) {
+                size_t i = cgScreen.Index(y, x);
+                chtype chtGlyph = Glyph(cgScreen.vec_u32Glyphs[i]);
+                mvwaddch(p_wndScreen, y, x, chtGlyph | cgScreen.vec_u32Attrs[i] | COLOR_PAIR(Pair(cgScreen.vec_u32Colors[i])));
+            });
+        }
+
+        wnoutrefresh(p_wndScreen);
+        doupdate();
+    }
+
+    void Invalidate() override
+    {
+        clearok(p_wndScreen, TRUE);
+    }
+
+  private:
+    std::unordered_map<uint32_t, short> map_iPairs;
+    int iNextPair = -1;
+
+  private:
+    // narrow chtype only carries 8 bits of color pair
+    short Pair(uint32_t u32Color)
+    {
+        if (u32Color == 0)
+            return 0;
+
+        auto it = map_iPairs.find(u32Color);
+        if (it != map_iPairs.end())
+            return it->second;
+
+        // narrow libcurses has no alloc_pair; hand out pairs from the top so
+        // the ones the application set up with init_pair stay untouched
+        if (iNextPair < 0)
+            iNextPair = std::min(COLOR_PAIRS, 256) - 1;
+
+        int iPair = 0;
+        if (iNextPair >= 16 &&
+            init_pair(iNextPair, CellColorFg(u32Color), CellColorBg(u32Color)) == OK)
+            iPair = iNextPair--;
+        map_iPairs[u32Color] = iPair;
+        return iPair;
+    }
+
+    // narrow ncurses cannot print code points, map line drawing back to ACS
+    static chtype Glyph(uint32_t u32Glyph)
+    {
+        if (u32Glyph < 0x80)
+            return u32Glyph;
+
+        switch (u32Glyph)
+        {
+        case 0x2500:
+            return ACS_HLINE;
+        case 0x2502:
+            return ACS_VLINE;
+        case 0x250c:
+            return ACS_ULCORNER;
+        case 0x2510:
+            return ACS_URCORNER;
+        case 0x2514:
+            return ACS_LLCORNER;
+        case 0x2518:
+            return ACS_LRCORNER;
+        case 0x251c:
+            return ACS_LTEE;
+        case 0x2524:
+            return ACS_RTEE;
+        case 0x252c:
+            return ACS_TTEE;
+        case 0x2534:
+            return ACS_BTEE;
+        case 0x253c:
+            return ACS_PLUS;
+        case 0x2592:
+            return ACS_CKBOARD;
+        case 0x25c6:
+            return ACS_DIAMOND;
+        case 0x00b7:
+            return ACS_BULLET;
+        default:
+            return '?';
+        }
+    }
+};
+
+// Writes straight to the tty. Changed cells are diffed against what the
+// terminal already shows and every frame goes out in a single write();
+// ncurses is only consulted for terminfo strings.
+struct VtBackend : ScreenBackend
+{
+    int iFd = STDOUT_FILENO;
+
+    VtBackend(int iFd = STDOUT_FILENO) : iFd(iFd)
+    {
+        strClear = TermString("clear", "\x1b[H\x1b[2J");
+        strEnterAcs = TermString("smacs", "\x1b(0");
+        strExitAcs = TermString("rmacs", "\x1b(B");
+        bEatNewlineGlitch = tigetflag(const_cast<char *>("xenl")) > 0;
+    }
+
+    // The diffing emits ANSI cursor and SGR sequences, so only use this
+    // backend when terminfo agrees the terminal speaks them
+    static bool Supported()
+    {
+        char *p_strCup = tigetstr(const_cast<char *>("cup"));
+        return p_strCup != nullptr && p_strCup != reinterpret_cast<char *>(-1) && strncmp(p_strCup, "\x1b[", 2) == 0;
+    }
+
+    void Present(const CellGrid &cgScreen) override
+    {
+        strOut.clear();
+
+        if (cgFront.iLines != cgScreen.iLines || cgFront.iCols != cgScreen.iCols)
+            bInvalid = true;
+
+        if (bInvalid)
+        {
+            cgFront.Resize(0, 0);
+            cgFront.Resize(cgScreen.iLines, cgScreen.iCols);
+
+            strOut += "\x1b[0m";
+            strOut += strClear;
+            u32CurAttr = 0;
+            u32CurColor = 0;
+            iCurY = iCurX = 0;
+        }
+
+        for (int y = 0; y < cgScreen.iLines; y++)
+        {
+            if (!bInvalid && !cgScreen.IsRowDirty(y))
+                continue;
+
+            PresentRow(cgScreen, y);
+        }
+        bInvalid = false;
+
+        if (strOut.empty())
+            return;
+
+        // never leave the terminal in the alternate character set between frames
+        if (u32CurAttr & A_ALTCHARSET)
+            strOut += strExitAcs;
+        u32CurAttr &= ~A_ALTCHARSET;
+
+        WriteAll(strOut.data(), strOut.size());
+    }
+
+    void Invalidate() override
+    {
+        bInvalid = true;
+    }
+
+  private:
+    CellGrid cgFront;
+    std::string strOut;
+    std::vector<int> vec_iChanged;
+
+    std::string strClear, strEnterAcs, strExitAcs;
+    bool bEatNewlineGlitch = false;
+    bool bInvalid = true;
+
+    uint32_t u32CurAttr = 0;
+    uint32_t u32CurColor = 0;
+    int iCurY = -1, iCurX = -1;
+
+  private:
+    static std::string TermString(const char *c_strCap, const char *c_strFallback)
+    {
+        char *p_strValue = tigetstr(const_cast<char *>(c_strCap));
+        if (p_strValue == nullptr || p_strValue == reinterpret_cast<char *>(-1))
+            return c_strFallback;
+        return p_strValue;
+    }
+
+    bool SameAsFront(const CellGrid &cgScreen, size_t i) const
+    {
+        return cgFront.vec_u32Glyphs[i] == cgScreen.vec_u32Glyphs[i] && cgFront.vec_u32Attrs[i] == cgScreen.vec_u32Attrs[i] &&
+               cgFront.vec_u32Colors[i] == cgScreen.vec_u32Colors[i];
+    }
+
+    void PresentRow(const CellGrid &cgScreen, int y)
+    {
+        vec_iChanged.clear();
+
+        if (bInvalid)
+        {
+            // the terminal was just cleared, only non-blank cells need writing
+            for (int x = 0; x < cgScreen.iCols; x++)
+            {
+                size_t i = cgScreen.Index(y, x);
+                if (cgScreen.vec_u32Glyphs[i] != ' ' || cgScreen.vec_u32Attrs[i] != 0 || cgScreen.vec_u32Colors[i] != 0)
+                    vec_iChanged.push_back(x);
+            }
+        }
+        else
+        {
+            cgScreen.ForEachDirty(y, [&](int x) {
+                if (!SameAsFront(cgScreen, cgScreen.Index(y, x)))
+                    vec_iChanged.push_back(x);
+            });
+        }
+
+        int iLastX = cgScreen.iCols - 1;
+        if (y == cgScreen.iLines - 1 && !bEatNewlineGlitch)
+        {
+            // writing the bottom-right cell would scroll the terminal
+            while (!vec_iChanged.empty() && vec_iChanged.back() == iLastX)
+                vec_iChanged.pop_back();
+        }
+
+        size_t k = 0;
+        while (k < vec_iChanged.size())
+        {
+            int iFrom = vec_iChanged[k];
+            int iTo = iFrom + 1;
+            ++k;
+
+            // extend the run over short unchanged gaps when rewriting them is
+            // cheaper than a cursor move
+            while (k < vec_iChanged.size())
+            {
+                int iGap = vec_iChanged[k] - iTo;
+                if (iGap > 3 || !GapIsCheap(cgScreen, y, iTo, vec_iChanged[k], iFrom))
+                    break;
+                iTo = vec_iChanged[k] + 1;
+                ++k;
+            }
+
+            MoveTo(y, iFrom);
+            for (int x = iFrom; x < iTo; x++)
+            {
+                PutCell(cgScreen, y, x);
+            }
+        }
+    }
+
+    // gap cells must not force SGR changes of their own
+    bool GapIsCheap(const CellGrid &cgScreen, int y, int iFrom, int iTo, int iRunStart) const
+    {
+        size_t iRef = cgScreen.Index(y, iRunStart);
+        for (int x = iFrom; x < iTo; x++)
+        {
+            size_t i = cgScreen.Index(y, x);
+            if (cgScreen.vec_u32Attrs[i] != cgScreen.vec_u32Attrs[iRef] || cgScreen.vec_u32Colors[i] != cgScreen.vec_u32Colors[iRef])
+                return false;
+        }
+        return true;
+    }
+
+    void PutCell(const CellGrid &cgScreen, int y, int x)
+    {
+        size_t i = cgScreen.Index(y, x);
+
+        SetAttr(cgScreen.vec_u32Attrs[i], cgScreen.vec_u32Colors[i]);
+        PutGlyph(cgScreen.vec_u32Glyphs[i]);
+
+        cgFront.vec_u32Glyphs[i] = cgScreen.vec_u32Glyphs[i];
+        cgFront.vec_u32Attrs[i] = cgScreen.vec_u32Attrs[i];
+        cgFront.vec_u32Colors[i] = cgScreen.vec_u32Colors[i];
+
+        // after the last column the terminal is in its pending-wrap state
+        if (++iCurX >= cgScreen.iCols)
+            iCurY = iCurX = -1;
+    }
+
+    void PutGlyph(uint32_t u32Glyph)
+    {
+        if (u32Glyph < 0x20 || u32Glyph == 0x7f)
+            u32Glyph = ' ';
+
+        if (u32Glyph < 0x80)
+        {
+            strOut += static_cast<char>(u32Glyph);
+        }
+        else if (u32Glyph < 0x800)
+        {
+            strOut += static_cast<char>(0xc0 | (u32Glyph >> 6));
+            strOut += static_cast<char>(0x80 | (u32Glyph & 0x3f));
+        }
+        else if (u32Glyph < 0x10000)
+        {
+            strOut += static_cast<char>(0xe0 | (u32Glyph >> 12));
+            strOut += static_cast<char>(0x80 | ((u32Glyph >> 6) & 0x3f));
+            strOut += static_cast<char>(0x80 | (u32Glyph & 0x3f));
+        }
+        else
+        {
+            strOut += static_cast<char>(0xf0 | (u32Glyph >> 18));
+            strOut += static_cast<char>(0x80 | ((u32Glyph >> 12) & 0x3f));
+            strOut += static_cast<char>(0x80 | ((u32Glyph >> 6) & 0x3f));
+            strOut += static_cast<char>(0x80 | (u32Glyph & 0x3f));
+        }
+    }
+
+    static void AppendNumber(std::string &strDst, int iValue)
+    {
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "%d", iValue);
+        strDst.append(buf, n);
+    }
+
+    // Pick the shortest of the absolute and relative cursor motions
+    void MoveTo(int y, int x)
+    {
+        if (y == iCurY && x == iCurX)
+            return;
+
+        strMove.assign("\x1b[");
+        AppendNumber(strMove, y + 1);
+        if (x > 0)
+        {
+            strMove += ';';
+            AppendNumber(strMove, x + 1);
+        }
+        strMove += 'H';
+
+        if (iCurY >= 0)
+        {
+            auto fnTry = [&](const std::string &strCandidate) {
+                if (strCandidate.size() < strMove.size())
+                    strMove = strCandidate;
+            };
+
+            if (y == iCurY)
+            {
+                int n = x - iCurX;
+                strCandidate.assign(x == 0 ? "\r" : "\x1b[");
+                if (x != 0)
+                {
+                    if (n != 1 && n != -1)
+                        AppendNumber(strCandidate, n > 0 ? n : -n);
+                    strCandidate += n > 0 ? 'C' : 'D';
+                }
+                fnTry(strCandidate);
+
+                strCandidate.assign("\x1b[");
+                AppendNumber(strCandidate, x + 1);
+                strCandidate += 'G';
+                fnTry(strCandidate);
+            }
+            else if (x == 0 && y == iCurY + 1)
+            {
+                fnTry("\r\n");
+            }
+            else if (x == iCurX)
+            {
+                int n = y - iCurY;
+                strCandidate.assign("\x1b[");
+                if (n != 1 && n != -1)
+                    AppendNumber(strCandidate, n > 0 ? n : -n);
+                strCandidate += n > 0 ? 'B' : 'A';
+                fnTry(strCandidate);
+            }
+        }
+
+        strOut += strMove;
+        iCurY = y;
+        iCurX = x;
+    }
+
+    static void AppendColor(std::string &strDst, int iColor, int iBase)
+    {
+        strDst += ';';
+        if (iColor < 0)
+        {
+            AppendNumber(strDst, iBase + 9);
+        }
+        else if (iColor < 8)
+        {
+            AppendNumber(strDst, iBase + iColor);
+        }
+        else if (iColor < 16)
+        {
+            AppendNumber(strDst, iBase + 60 + iColor - 8);
+        }
+        else
+        {
+            AppendNumber(strDst, iBase + 8);
+            strDst += ";5;";
+            AppendNumber(strDst, iColor);
+        }
+    }
+
+    // Emit only the SGR parameters that differ, resetting when an attribute has to be removed
+    void SetAttr(uint32_t u32Attr, uint32_t u32Color)
+    {
+        if ((u32Attr & A_ALTCHARSET) != (u32CurAttr & A_ALTCHARSET))
+            strOut += (u32Attr & A_ALTCHARSET) ? strEnterAcs : strExitAcs;
+
+        uint32_t u32Sgr = u32Attr & ~A_ALTCHARSET;
+        uint32_t u32CurSgr = u32CurAttr & ~A_ALTCHARSET;
+        if (u32Sgr == u32CurSgr && u32Color == u32CurColor)
+        {
+            u32CurAttr = u32Attr;
+            return;
+        }
+
+        strCandidate.assign("\x1b[");
+        uint32_t u32Add = u32Sgr & ~u32CurSgr;
+        bool bReset = (u32CurSgr & ~u32Sgr) != 0;
+        int iFg = CellColorFg(u32Color), iBg = CellColorBg(u32Color);
+        int iCurFg = CellColorFg(u32CurColor), iCurBg = CellColorBg(u32CurColor);
+
+        if (bReset)
+        {
+            strCandidate += '0';
+            u32Add = u32Sgr;
+            iCurFg = iCurBg = -1;
+        }
+
+        const std::pair<uint32_t, int> c_arrSgr[] = {{A_BOLD, 1}, {A_DIM, 2},     {A_ITALIC, 3}, {A_UNDERLINE, 4},
+                                                     {A_BLINK, 5}, {A_REVERSE, 7}, {A_STANDOUT, 7}, {A_INVIS, 8}};
+        for (const auto &sgr : c_arrSgr)
+        {
+            if (u32Add & sgr.first)
+            {
+                strCandidate += ';';
+                AppendNumber(strCandidate, sgr.second);
+            }
+        }
+        if (iFg != iCurFg)
+            AppendColor(strCandidate, iFg, 30);
+        if (iBg != iCurBg)
+            AppendColor(strCandidate, iBg, 40);
+
+        // "\x1b[;1m" and "\x1b[0m" are both valid, drop the leading separator when not resetting
+        if (!bReset && strCandidate.size() > 2 && strCandidate[2] == ';')
+            strCandidate.erase(2, 1);
+        if (strCandidate.size() > 2)
+        {
+            strCandidate += 'm';
+            strOut += strCandidate;
+        }
+
+        u32CurAttr = u32Attr;
+        u32CurColor = u32Color;
+    }
+
+    void WriteAll(const char *c_p_chData, size_t u_iSize)
+    {
+        ++u64Writes;
+        while (u_iSize > 0)
+        {
+            ssize_t n = write(iFd, c_p_chData, u_iSize);
+            if (n < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN)
+                    continue;
+                bInvalid = true;
+                return;
+            }
+
+            u64BytesWritten += n;
+            c_p_chData += n;
+            u_iSize -= n;
+        }
+    }
+
+  private:
+    std::string strMove, strCandidate;
+};
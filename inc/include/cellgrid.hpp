@@ -0,0 +1,303 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+#include <algorithm>
+
+// -1 is the terminal's default color, so a zero color means default on default
+inline uint32_t MakeCellColor(int iFg, int iBg)
+{
+    return uint32_t(iFg + 1) | (uint32_t(iBg + 1) << 16);
+}
+
+inline int CellColorFg(uint32_t u32Color)
+{
+    return int(u32Color & 0xffff) - 1;
+}
+
+inline int CellColorBg(uint32_t u32Color)
+{
+    return int(u32Color >> 16) - 1;
+}
+
+// Glyphs are code points, attrs use the ncurses A_* bits without A_COLOR,
+// colors pack a foreground and background palette index (see MakeCellColor).
+// A row's cells are contiguous, but rows are found through vec_iRows: once
+// ScrollRows has run they are no longer in storage order, so cells are
+// addressed through the grid's own Index.
+struct CellGrid
+{
+    int iCols = 0, iLines = 0;
+    int iDirtyWords = 0;
+
+    std::vector<uint32_t> vec_u32Glyphs;
+    std::vector<uint32_t> vec_u32Attrs;
+    std::vector<uint32_t> vec_u32Colors;
+    std::vector<int> vec_iRows; // storage row of each line
+
+    // per-row dirty bitmaps, iDirtyWords words per row, plus a per-row summary
+    std::vector<uint64_t> vec_u64DirtyBits;
+    std::vector<uint8_t> vec_u8RowDirty;
+
+    CellGrid() {}
+
+    CellGrid(int lines, int cols)
+    {
+        Resize(lines, cols);
+    }
+
+    void Resize(int lines, int cols, uint32_t u32Glyph = ' ', uint32_t u32Attr = 0, uint32_t u32Color = 0)
+    {
+        lines = std::max(lines, 0);
+        cols = std::max(cols, 0);
+
+        std::vector<uint32_t> vec_u32NewGlyphs(size_t(lines) * cols, u32Glyph);
+        std::vector<uint32_t> vec_u32NewAttrs(size_t(lines) * cols, u32Attr);
+        std::vector<uint32_t> vec_u32NewColors(size_t(lines) * cols, u32Color);
+
+        // keep the overlapping region, like wresize
+        int iKeepLines = std::min(lines, iLines);
+        int iKeepCols = std::min(cols, iCols);
+        for (int y = 0; y < iKeepLines; y++)
+        {
+            std::copy_n(&vec_u32Glyphs[Index(y, 0)], iKeepCols, &vec_u32NewGlyphs[size_t(y) * cols]);
+            std::copy_n(&vec_u32Attrs[Index(y, 0)], iKeepCols, &vec_u32NewAttrs[size_t(y) * cols]);
+            std::copy_n(&vec_u32Colors[Index(y, 0)], iKeepCols, &vec_u32NewColors[size_t(y) * cols]);
+        }
+
+        vec_u32Glyphs.swap(vec_u32NewGlyphs);
+        vec_u32Attrs.swap(vec_u32NewAttrs);
+        vec_u32Colors.swap(vec_u32NewColors);
+
+        iLines = lines;
+        iCols = cols;
+        vec_iRows.resize(lines);
+        std::iota(vec_iRows.begin(), vec_iRows.end(), 0);
+        iDirtyWords = (cols + 63) / 64;
+        vec_u64DirtyBits.assign(size_t(lines) * iDirtyWords, 0);
+        vec_u8RowDirty.assign(lines, 0);
+
+        MarkAllDirty();
+    }
+
+    size_t Index(int y, int x) const
+    {
+        return size_t(vec_iRows[y]) * iCols + x;
+    }
+
+    bool Contains(int y, int x) const
+    {
+        return y >= 0 && y < iLines && x >= 0 && x < iCols;
+    }
+
+    // write a cell, marking it dirty only when its content actually changes
+    bool Set(int y, int x, uint32_t u32Glyph, uint32_t u32Attr, uint32_t u32Color)
+    {
+        size_t i = Index(y, x);
+        if (vec_u32Glyphs[i] == u32Glyph && vec_u32Attrs[i] == u32Attr && vec_u32Colors[i] == u32Color)
+            return false;
+
+        vec_u32Glyphs[i] = u32Glyph;
+        vec_u32Attrs[i] = u32Attr;
+        vec_u32Colors[i] = u32Color;
+        MarkDirty(y, x);
+        return true;
+    }
+
+    // write n single-byte glyphs from row y, column x, dirtying the changed span
+    void SetRun(int y, int x, const unsigned char *c_p_u8Glyphs, int n, uint32_t u32Attr, uint32_t u32Color)
+    {
+        size_t i = Index(y, x);
+        int iFirst = n, iLast = -1;
+        for (int k = 0; k < n; k++, i++)
+        {
+            uint32_t u32Glyph = c_p_u8Glyphs[k];
+            if (vec_u32Glyphs[i] == u32Glyph && vec_u32Attrs[i] == u32Attr && vec_u32Colors[i] == u32Color)
+                continue;
+
+            vec_u32Glyphs[i] = u32Glyph;
+            vec_u32Attrs[i] = u32Attr;
+            vec_u32Colors[i] = u32Color;
+            iFirst = std::min(iFirst, k);
+            iLast = k;
+        }
+
+        if (iLast >= 0)
+            MarkRowDirty(y, x + iFirst, x + iLast + 1);
+    }
+
+    void FillRow(int y, int x0, int x1, uint32_t u32Glyph, uint32_t u32Attr, uint32_t u32Color)
+    {
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, iCols);
+        for (int x = x0; x < x1; x++)
+        {
+            Set(y, x, u32Glyph, u32Attr, u32Color);
+        }
+    }
+
+    void Fill(uint32_t u32Glyph, uint32_t u32Attr, uint32_t u32Color)
+    {
+        for (int y = 0; y < iLines; y++)
+        {
+            FillRow(y, 0, iCols, u32Glyph, u32Attr, u32Color);
+        }
+    }
+
+    // Scroll rows [iTop, iBottom) up by n (down when n < 0), blanking the rows scrolled in.
+    // Only the row order turns, so a scroll costs the rows blanked, not the
+    // rows kept: a flood of output scrolls one line at a time
+    void ScrollRows(int iTop, int iBottom, int n, uint32_t u32Glyph, uint32_t u32Attr, uint32_t u32Color)
+    {
+        iTop = std::max(iTop, 0);
+        iBottom = std::min(iBottom, iLines);
+        int iHeight = iBottom - iTop;
+        if (iHeight <= 0 || n == 0)
+            return;
+        if (n >= iHeight || -n >= iHeight)
+            n = n > 0 ? iHeight : -iHeight;
+
+        std::rotate(vec_iRows.begin() + iTop, vec_iRows.begin() + iTop + (n > 0 ? n : iHeight + n),
+                    vec_iRows.begin() + iBottom);
+
+        int iBlankFrom = n > 0 ? iBottom - n : iTop;
+        int iBlankTo = n > 0 ? iBottom : iTop - n;
+        for (int y = iBlankFrom; y < iBlankTo; y++)
+        {
+            size_t i = Index(y, 0);
+            std::fill_n(vec_u32Glyphs.begin() + i, iCols, u32Glyph);
+            std::fill_n(vec_u32Attrs.begin() + i, iCols, u32Attr);
+            std::fill_n(vec_u32Colors.begin() + i, iCols, u32Color);
+        }
+
+        for (int y = iTop; y < iBottom; y++)
+        {
+            MarkRowDirty(y);
+        }
+    }
+
+    // Shift cells [x, iCols) of row y right by n (left when n < 0), blanking the cells shifted in
+    void ShiftCells(int y, int x, int n, uint32_t u32Glyph, uint32_t u32Attr, uint32_t u32Color)
+    {
+        int iWidth = iCols - x;
+        if (x < 0 || iWidth <= 0 || n == 0)
+            return;
+        if (n >= iWidth || -n >= iWidth)
+            n = n > 0 ? iWidth : -iWidth;
+
+        size_t i = Index(y, x);
+        int iKeep = iWidth - (n > 0 ? n : -n);
+        size_t dst = n > 0 ? i + n : i;
+        size_t src = n > 0 ? i : i - n;
+        std::memmove(&vec_u32Glyphs[dst], &vec_u32Glyphs[src], iKeep * sizeof(uint32_t));
+        std::memmove(&vec_u32Attrs[dst], &vec_u32Attrs[src], iKeep * sizeof(uint32_t));
+        std::memmove(&vec_u32Colors[dst], &vec_u32Colors[src], iKeep * sizeof(uint32_t));
+
+        size_t iBlank = n > 0 ? i : i + iKeep;
+        int iBlankCount = n > 0 ? n : -n;
+        std::fill_n(vec_u32Glyphs.begin() + iBlank, iBlankCount, u32Glyph);
+        std::fill_n(vec_u32Attrs.begin() + iBlank, iBlankCount, u32Attr);
+        std::fill_n(vec_u32Colors.begin() + iBlank, iBlankCount, u32Color);
+
+        MarkRowDirty(y, x);
+    }
+
+    void MarkDirty(int y, int x)
+    {
+        vec_u64DirtyBits[size_t(y) * iDirtyWords + (x >> 6)] |= uint64_t(1) << (x & 63);
+        vec_u8RowDirty[y] = 1;
+    }
+
+    void MarkRowDirty(int y, int x0 = 0, int x1 = -1)
+    {
+        if (x1 < 0 || x1 > iCols)
+            x1 = iCols;
+        x0 = std::max(x0, 0);
+        if (x0 >= x1)
+            return;
+
+        uint64_t *p_u64Words = &vec_u64DirtyBits[size_t(y) * iDirtyWords];
+        for (int w = x0 >> 6; w <= (x1 - 1) >> 6; w++)
+        {
+            uint64_t u64Mask = ~uint64_t(0);
+            if (w == x0 >> 6)
+                u64Mask &= ~uint64_t(0) << (x0 & 63);
+            if (w == (x1 - 1) >> 6)
+                u64Mask &= ~uint64_t(0) >> (63 - ((x1 - 1) & 63));
+            p_u64Words[w] |= u64Mask;
+        }
+        vec_u8RowDirty[y] = 1;
+    }
+
+    void MarkAllDirty()
+    {
+        for (int y = 0; y < iLines; y++)
+        {
+            MarkRowDirty(y);
+        }
+    }
+
+    void ClearDirty()
+    {
+        std::fill(vec_u64DirtyBits.begin(), vec_u64DirtyBits.end(), 0);
+        std::fill(vec_u8RowDirty.begin(), vec_u8RowDirty.end(), 0);
+    }
+
+    void ClearRowDirty(int y)
+    {
+        std::fill_n(&vec_u64DirtyBits[size_t(y) * iDirtyWords], iDirtyWords, 0);
+        vec_u8RowDirty[y] = 0;
+    }
+
+    bool IsRowDirty(int y) const
+    {
+        return vec_u8RowDirty[y] != 0;
+    }
+
+    bool IsDirty(int y, int x) const
+    {
+        return (vec_u64DirtyBits[size_t(y) * iDirtyWords + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    bool AnyDirty() const
+    {
+        return std::find(vec_u8RowDirty.begin(), vec_u8RowDirty.end(), 1) != vec_u8RowDirty.end();
+    }
+
+    // first and one-past-last dirty column of row y
+    bool DirtySpan(int y, int *p_iFrom, int *p_iTo) const
+    {
+        if (!IsRowDirty(y))
+            return false;
+
+        const uint64_t *p_u64Words = &vec_u64DirtyBits[size_t(y) * iDirtyWords];
+        int iFirst = 0, iLast = iDirtyWords - 1;
+        while (iFirst < iDirtyWords && !p_u64Words[iFirst])
+            ++iFirst;
+        if (iFirst == iDirtyWords)
+            return false;
+        while (!p_u64Words[iLast])
+            --iLast;
+
+        *p_iFrom = iFirst * 64 + __builtin_ctzll(p_u64Words[iFirst]);
+        *p_iTo = iLast * 64 + 64 - __builtin_clzll(p_u64Words[iLast]);
+        return true;
+    }
+
+    // calls fn(x) for every dirty column of row y, in order
+    template <typename Fn>
+    void ForEachDirty(int y, Fn fn) const
+    {
+        const uint64_t *p_u64Words = &vec_u64DirtyBits[size_t(y) * iDirtyWords];
+        for (int w = 0; w < iDirtyWords; w++)
+        {
+            uint64_t u64Bits = p_u64Words[w];
+            while (u64Bits)
+            {
+                fn(w * 64 + __builtin_ctzll(u64Bits));
+                u64Bits &= u64Bits - 1;
+            }
+        }
+    }
+};
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#define FORMAT_BUFFER_SIZE 512
+
+// Compile-time parsed replacement for printf-style formats, used as
+// AWindow::Print<"FPS: {:.1f}">(fps). Fields are {} or {:[<>][width][.precision][type]}
+// with type d, x, f, s or c; {{ and }} are literal braces. The format is
+// parsed once by the compiler, which also rejects a field count or type
+// that does not match the arguments.
+template <size_t N>
+struct FormatString
+{
+    char arr_chText[N] = {};
+
+    consteval FormatString(const char (&c_arrText)[N])
+    {
+        for (size_t i = 0; i < N; i++)
+            arr_chText[i] = c_arrText[i];
+    }
+};
+
+struct FormatField
+{
+    size_t u_iLiteralBegin = 0, u_iLiteralEnd = 0; // literal text before the field
+    char chAlign = 0;
+    int iWidth = 0;
+    int iPrecision = -1;
+    char chType = 0;
+};
+
+template <size_t N>
+struct ParsedFormat
+{
+    char arr_chLiteral[N] = {}; // all literal text, escapes resolved
+    size_t u_iLiteralSize = 0;
+    FormatField arr_fldFields[N / 2 + 1] = {};
+    size_t u_iFields = 0;
+    size_t u_iTailBegin = 0;
+};
+
+// not constexpr, so reaching it while parsing fails the build and names the problem
+inline void FormatErrorUnmatchedBrace() {}
+inline void FormatErrorBadSpec() {}
+
+template <size_t N>
+consteval ParsedFormat<N> ParseFormat(const FormatString<N> &fsFormat)
+{
+    ParsedFormat<N> pfParsed;
+    const char *c_p_chText = fsFormat.arr_chText;
+    size_t u_iSize = N - 1;
+    size_t u_iLiteralBegin = 0;
+
+    for (size_t i = 0; i < u_iSize; i++)
+    {
+        char ch = c_p_chText[i];
+        if (ch == '}')
+        {
+            if (i + 1 >= u_iSize || c_p_chText[i + 1] != '}')
+                FormatErrorUnmatchedBrace();
+            pfParsed.arr_chLiteral[pfParsed.u_iLiteralSize++] = '}';
+            ++i;
+            continue;
+        }
+        if (ch != '{')
+        {
+            pfParsed.arr_chLiteral[pfParsed.u_iLiteralSize++] = ch;
+            continue;
+        }
+        if (i + 1 < u_iSize && c_p_chText[i + 1] == '{')
+        {
+            pfParsed.arr_chLiteral[pfParsed.u_iLiteralSize++] = '{';
+            ++i;
+            continue;
+        }
+
+        FormatField fldField;
+        fldField.u_iLiteralBegin = u_iLiteralBegin;
+        fldField.u_iLiteralEnd = pfParsed.u_iLiteralSize;
+        ++i;
+
+        if (i < u_iSize && c_p_chText[i] == ':')
+        {
+            ++i;
+            if (i < u_iSize && (c_p_chText[i] == '<' || c_p_chText[i] == '>'))
+                fldField.chAlign = c_p_chText[i++];
+            while (i < u_iSize && c_p_chText[i] >= '0' && c_p_chText[i] <= '9')
+                fldField.iWidth = fldField.iWidth * 10 + (c_p_chText[i++] - '0');
+            if (i < u_iSize && c_p_chText[i] == '.')
+            {
+                fldField.iPrecision = 0;
+                ++i;
+                if (i >= u_iSize || c_p_chText[i] < '0' || c_p_chText[i] > '9')
+                    FormatErrorBadSpec();
+                while (i < u_iSize && c_p_chText[i] >= '0' && c_p_chText[i] <= '9')
+                    fldField.iPrecision = fldField.iPrecision * 10 + (c_p_chText[i++] - '0');
+            }
+            if (i < u_iSize && c_p_chText[i] != '}')
+            {
+                char chType = c_p_chText[i++];
+                if (chType != 'd' && chType != 'x' && chType != 'f' && chType != 's' && chType != 'c')
+                    FormatErrorBadSpec();
+                fldField.chType = chType;
+            }
+        }
+        if (i >= u_iSize || c_p_chText[i] != '}')
+            FormatErrorUnmatchedBrace();
+
+        pfParsed.arr_fldFields[pfParsed.u_iFields++] = fldField;
+        u_iLiteralBegin = pfParsed.u_iLiteralSize;
+    }
+
+    pfParsed.u_iTailBegin = u_iLiteralBegin;
+    return pfParsed;
+}
+
+template <typename T>
+constexpr bool FormatIsString()
+{
+    using U = std::decay_t<T>;
+    return std::is_same_v<U, const char *> || std::is_same_v<U, char *> || std::is_same_v<U, std::string> ||
+           std::is_same_v<U, std::string_view>;
+}
+
+// which field types an argument of type T may be printed with
+template <typename T>
+constexpr bool FormatAccepts(char chType)
+{
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, char>)
+        return chType == 0 || chType == 'c';
+    else if constexpr (std::is_same_v<U, bool>)
+        return chType == 0 || chType == 's';
+    else if constexpr (std::is_integral_v<U>)
+        return chType == 0 || chType == 'd' || chType == 'x';
+    else if constexpr (std::is_floating_point_v<U>)
+        return chType == 0 || chType == 'f';
+    else if constexpr (FormatIsString<T>())
+        return chType == 0 || chType == 's';
+    else
+        return false;
+}
+
+// Fixed-size output; anything past the end is dropped
+struct FormatBuffer
+{
+    char arr_chData[FORMAT_BUFFER_SIZE];
+    size_t u_iSize = 0;
+
+    void Append(const char *c_p_chData, size_t u_iCount)
+    {
+        u_iCount = std::min(u_iCount, sizeof(arr_chData) - u_iSize);
+        std::memcpy(arr_chData + u_iSize, c_p_chData, u_iCount);
+        u_iSize += u_iCount;
+    }
+
+    void Fill(size_t u_iCount)
+    {
+        u_iCount = std::min(u_iCount, sizeof(arr_chData) - u_iSize);
+        std::memset(arr_chData + u_iSize, ' ', u_iCount);
+        u_iSize += u_iCount;
+    }
+
+    // pad c_p_chData to the field width, numbers to the right and text to the left
+    void AppendField(const FormatField &fldField, const char *c_p_chData, size_t u_iCount, bool bNumber)
+    {
+        size_t u_iPad = fldField.iWidth > static_cast<int>(u_iCount) ? fldField.iWidth - u_iCount : 0;
+        bool bLeft = fldField.chAlign == '<' || (fldField.chAlign == 0 && !bNumber);
+
+        if (!bLeft)
+            Fill(u_iPad);
+        Append(c_p_chData, u_iCount);
+        if (bLeft)
+            Fill(u_iPad);
+    }
+
+    template <typename T>
+    void AppendArg(const FormatField &fldField, const T &tArg)
+    {
+        char arr_chNumber[64];
+        using U = std::decay_t<T>;
+
+        if constexpr (std::is_same_v<U, char>)
+        {
+            AppendField(fldField, &tArg, 1, false);
+        }
+        else if constexpr (std::is_same_v<U, bool>)
+        {
+            AppendField(fldField, tArg ? "true" : "false", tArg ? 4 : 5, false);
+        }
+        else if constexpr (std::is_integral_v<U>)
+        {
+            auto res = std::to_chars(arr_chNumber, arr_chNumber + sizeof(arr_chNumber), tArg, fldField.chType == 'x' ? 16 : 10);
+            AppendField(fldField, arr_chNumber, res.ptr - arr_chNumber, true);
+        }
+        else if constexpr (std::is_floating_point_v<U>)
+        {
+            // like %f when only the type is given, shortest round-trip for a bare {}
+            std::to_chars_result res;
+            if (fldField.iPrecision >= 0 || fldField.chType == 'f')
+                res = std::to_chars(arr_chNumber, arr_chNumber + sizeof(arr_chNumber), tArg, std::chars_format::fixed,
+                                    fldField.iPrecision >= 0 ? fldField.iPrecision : 6);
+            else
+                res = std::to_chars(arr_chNumber, arr_chNumber + sizeof(arr_chNumber), tArg);
+            if (res.ec != std::errc())
+                AppendField(fldField, "?", 1, true);
+            else
+                AppendField(fldField, arr_chNumber, res.ptr - arr_chNumber, true);
+        }
+        else
+        {
+            std::string_view svText;
+            if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>)
+                svText = tArg != nullptr ? std::string_view(tArg) : std::string_view("(null)");
+            else
+                svText = tArg;
+            // a precision on text is its maximum length
+            if (fldField.iPrecision >= 0 && svText.size() > static_cast<size_t>(fldField.iPrecision))
+                svText = svText.substr(0, fldField.iPrecision);
+            AppendField(fldField, svText.data(), svText.size(), false);
+        }
+    }
+};
+
+template <FormatString Fmt>
+inline constexpr auto c_pfParsedFormat = ParseFormat(Fmt);
+
+template <FormatString Fmt, size_t... I, typename... Args>
+void FormatFields(FormatBuffer &fbOut, std::index_sequence<I...>, const Args &...args)
+{
+    constexpr const auto &c_pfParsed = c_pfParsedFormat<Fmt>;
+    static_assert((FormatAccepts<Args>(c_pfParsed.arr_fldFields[I].chType) && ...),
+                  "format field type does not match its argument");
+
+    (
+        [&]() {
+            const FormatField &fldField = c_pfParsed.arr_fldFields[I];
+            fbOut.Append(c_pfParsed.arr_chLiteral + fldField.u_iLiteralBegin, fldField.u_iLiteralEnd - fldField.u_iLiteralBegin);
+            fbOut.AppendArg(fldField, args);
+        }(),
+        ...);
+
+    fbOut.Append(c_pfParsed.arr_chLiteral + c_pfParsed.u_iTailBegin, c_pfParsed.u_iLiteralSize - c_pfParsed.u_iTailBegin);
+}
+
+// Format into fbOut, which is cleared first
+template <FormatString Fmt, typename... Args>
+void FormatTo(FormatBuffer &fbOut, const Args &...args)
+{
+    static_assert(c_pfParsedFormat<Fmt>.u_iFields == sizeof...(Args), "format field count does not match the arguments");
+
+    fbOut.u_iSize = 0;
+    FormatFields<Fmt>(fbOut, std::index_sequence_for<Args...>{}, args...);
+}
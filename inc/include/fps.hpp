@@ -2,6 +2,9 @@
 #include <ratio>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <cstdint>
+#include <vector>
 
 template <std::intmax_t FPS>
 class frame_rater
@@ -33,20 +36,20 @@ class frame_rater
 class frame_counter
 {
     int frameCount = 0;
-    std::chrono::system_clock::time_point lastTime = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point curTime = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point lastTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point curTime = std::chrono::steady_clock::now();
 
   public:
     bool noUpdateDelay = false;
     double updateDelay = 0.8;
-    double fps = 0.0;
+    std::atomic<double> fps{0.0}; // written by the counting thread, read anywhere
 
     void count()
     {
         using namespace std;
         using namespace std::chrono;
 
-        curTime = system_clock::now();
+        curTime = steady_clock::now();
 
         auto duration = duration_cast<microseconds>(curTime - lastTime);
         double duration_s = double(duration.count()) * microseconds::period::num / microseconds::period::den;
@@ -61,3 +64,98 @@ class frame_counter
         ++frameCount;
     }
 };
+
+inline int64_t frame_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// percentiles in microseconds over some interval of a frame_histogram
+struct frame_stats
+{
+    uint64_t count = 0;
+    double p50 = 0, p95 = 0, p99 = 0, max = 0;
+};
+
+// Log-linear histogram of durations: exact below 16ns, then 16 linear buckets
+// per power of two, so any value lands within ~6% of its bucket. record() is
+// a single relaxed increment and safe from any thread.
+class frame_histogram
+{
+    static constexpr int subBits = 4;
+    static constexpr int subCount = 1 << subBits;
+    static constexpr int maxExponent = 39; // ~9 minutes
+    static constexpr int bucketCount = (maxExponent - subBits + 2) * subCount;
+
+    std::atomic<uint32_t> buckets[bucketCount] = {};
+
+    static int bucket_of(uint64_t ns)
+    {
+        if (ns < subCount)
+            return static_cast<int>(ns);
+
+        int exponent = 63 - __builtin_clzll(ns);
+        if (exponent > maxExponent)
+            return bucketCount - 1;
+        int sub = static_cast<int>(ns >> (exponent - subBits)) & (subCount - 1);
+        return (exponent - subBits + 1) * subCount + sub;
+    }
+
+    // middle of the range bucket i covers
+    static double bucket_value(int i)
+    {
+        if (i < subCount)
+            return i;
+
+        int exponent = i / subCount + subBits - 1;
+        uint64_t low = uint64_t(subCount + i % subCount) << (exponent - subBits);
+        return low + double(uint64_t(1) << (exponent - subBits)) / 2;
+    }
+
+  public:
+    // what a reader has already seen, see collect()
+    typedef std::vector<uint32_t> cursor;
+
+    void record(int64_t ns)
+    {
+        buckets[bucket_of(ns < 0 ? 0 : static_cast<uint64_t>(ns))].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Statistics of everything recorded since the previous collect() with the
+    // same cursor. Each reader keeps its own, so nothing is ever reset.
+    frame_stats collect(cursor &seen) const
+    {
+        seen.resize(bucketCount);
+
+        uint32_t delta[bucketCount];
+        uint64_t total = 0;
+        for (int i = 0; i < bucketCount; i++)
+        {
+            uint32_t now = buckets[i].load(std::memory_order_relaxed);
+            delta[i] = now - seen[i];
+            seen[i] = now;
+            total += delta[i];
+        }
+
+        frame_stats stats;
+        stats.count = total;
+        if (total == 0)
+            return stats;
+
+        const double ranks[] = {0.50, 0.95, 0.99};
+        double *outs[] = {&stats.p50, &stats.p95, &stats.p99};
+        uint64_t running = 0;
+        int next = 0;
+        for (int i = 0; i < bucketCount; i++)
+        {
+            if (delta[i] == 0)
+                continue;
+
+            running += delta[i];
+            while (next < 3 && running >= ranks[next] * total)
+                *outs[next++] = bucket_value(i) / 1000.0;
+            stats.max = bucket_value(i) / 1000.0;
+        }
+        return stats;
+    }
+};
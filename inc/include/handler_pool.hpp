@@ -0,0 +1,223 @@
+#pragma once
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <coroutine>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fire-and-forget coroutine for a window handler. It starts suspended, is
+// started by HandlerPool::Spawn and frees its frame when it returns.
+struct HandlerTask
+{
+    struct promise_type
+    {
+        HandlerTask get_return_object()
+        {
+            return HandlerTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> hCoroutine;
+};
+
+// Fixed set of worker threads resuming coroutines. Each worker pops its own
+// deque from the back and steals from the front of the others; idle workers
+// sleep on a futex until something is scheduled.
+class HandlerPool
+{
+  public:
+    explicit HandlerPool(unsigned int u_iThreads = 0)
+    {
+        if (u_iThreads == 0)
+            u_iThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        for (unsigned int i = 0; i < u_iThreads; i++)
+        {
+            vec_p_wkWorkers.emplace_back(new Worker);
+        }
+        for (unsigned int i = 0; i < u_iThreads; i++)
+        {
+            vec_thThreads.emplace_back(&HandlerPool::Run, this, i);
+        }
+    }
+
+    ~HandlerPool()
+    {
+        bStopping = true;
+        u32Epoch.fetch_add(1);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&u32Epoch), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+        for (std::thread &th : vec_thThreads)
+        {
+            th.join();
+        }
+    }
+
+    HandlerPool(const HandlerPool &) = delete;
+    HandlerPool &operator=(const HandlerPool &) = delete;
+
+    void Spawn(HandlerTask htTask)
+    {
+        Schedule(htTask.hCoroutine);
+    }
+
+    // Queue a coroutine to be resumed, from any thread
+    void Schedule(std::coroutine_handle<> hCoroutine)
+    {
+        // workers keep their own continuations local, others are dealt round-robin
+        size_t i = t_iWorker >= 0 && t_p_hpOwner == this ? t_iWorker : u_iNextWorker++ % vec_p_wkWorkers.size();
+        {
+            std::lock_guard<std::mutex> lock(vec_p_wkWorkers[i]->mtx);
+            vec_p_wkWorkers[i]->deq_hReady.push_back(hCoroutine);
+        }
+
+        u32Epoch.fetch_add(1);
+        if (iSleeping.load() > 0)
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&u32Epoch), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    size_t Size() const
+    {
+        return vec_p_wkWorkers.size();
+    }
+
+  private:
+    struct Worker
+    {
+        std::mutex mtx;
+        std::deque<std::coroutine_handle<>> deq_hReady;
+    };
+
+    std::vector<std::unique_ptr<Worker>> vec_p_wkWorkers;
+    std::vector<std::thread> vec_thThreads;
+    std::atomic<size_t> u_iNextWorker{0};
+    std::atomic<uint32_t> u32Epoch{0};
+    std::atomic_int iSleeping{0};
+    std::atomic_bool bStopping{false};
+
+    static inline thread_local int t_iWorker = -1;
+    static inline thread_local HandlerPool *t_p_hpOwner = nullptr;
+
+  private:
+    bool Take(size_t i, bool bOwn, std::coroutine_handle<> *p_hCoroutine)
+    {
+        Worker &wk = *vec_p_wkWorkers[i];
+        std::lock_guard<std::mutex> lock(wk.mtx);
+        if (wk.deq_hReady.empty())
+            return false;
+
+        if (bOwn)
+        {
+            *p_hCoroutine = wk.deq_hReady.back();
+            wk.deq_hReady.pop_back();
+        }
+        else
+        {
+            *p_hCoroutine = wk.deq_hReady.front();
+            wk.deq_hReady.pop_front();
+        }
+        return true;
+    }
+
+    bool Find(size_t i, std::coroutine_handle<> *p_hCoroutine)
+    {
+        if (Take(i, true, p_hCoroutine))
+            return true;
+
+        for (size_t k = 1; k < vec_p_wkWorkers.size(); k++)
+        {
+            if (Take((i + k) % vec_p_wkWorkers.size(), false, p_hCoroutine))
+                return true;
+        }
+        return false;
+    }
+
+    void Run(size_t i)
+    {
+        t_iWorker = static_cast<int>(i);
+        t_p_hpOwner = this;
+
+        char arr_chName[16];
+        snprintf(arr_chName, sizeof(arr_chName), "handler-%zu", i);
+        pthread_setname_np(pthread_self(), arr_chName);
+
+        while (!bStopping)
+        {
+            std::coroutine_handle<> hCoroutine;
+            if (Find(i, &hCoroutine))
+            {
+                hCoroutine.resume();
+                continue;
+            }
+
+            // read the epoch before the last look, so a Schedule in between
+            // makes the futex wait return at once
+            uint32_t u32Seen = u32Epoch.load();
+            ++iSleeping;
+            if (Find(i, &hCoroutine))
+            {
+                --iSleeping;
+                hCoroutine.resume();
+                continue;
+            }
+            if (!bStopping)
+                syscall(SYS_futex, reinterpret_cast<uint32_t *>(&u32Epoch), FUTEX_WAIT_PRIVATE, u32Seen, nullptr, nullptr, 0);
+            --iSleeping;
+        }
+    }
+};
+
+// Coroutines waiting for the next composited frame
+class FrameSignal
+{
+  public:
+    void Add(std::coroutine_handle<> hCoroutine)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        vec_hWaiting.push_back(hCoroutine);
+    }
+
+    void Fire(HandlerPool *p_hpPool)
+    {
+        std::vector<std::coroutine_handle<>> vec_hReady;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            vec_hReady.swap(vec_hWaiting);
+        }
+
+        for (std::coroutine_handle<> hCoroutine : vec_hReady)
+        {
+            p_hpPool->Schedule(hCoroutine);
+        }
+    }
+
+  private:
+    std::mutex mtx;
+    std::vector<std::coroutine_handle<>> vec_hWaiting;
+};
@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "utils.hpp"
+
+#define LAYOUT_NONE -1
+#define LAYOUT_LEAF 0
+#define LAYOUT_ROWS 1 // children stacked top to bottom
+#define LAYOUT_COLS 2 // children side by side
+
+// A split tree of window areas. Each split shares its extent among its
+// children: every child first gets its minimum, what is left goes by
+// weight, and weight 0 keeps a child at its minimum. Nodes remember the
+// area they were last given, so Arrange only walks into subtrees whose
+// area or structure changed and reports only leaves whose area moved.
+class LayoutTree
+{
+  public:
+    typedef int node;
+
+    // iParent LAYOUT_NONE makes the split the root, dropping any old tree
+    node AddSplit(node iParent, int iKind, int iWeight = 1, int iMinLines = 0, int iMinCols = 0)
+    {
+        if (iParent == LAYOUT_NONE)
+        {
+            vec_ndNodes.clear();
+            iRoot = NewNode(LAYOUT_NONE, iKind, iWeight, iMinLines, iMinCols);
+            return iRoot;
+        }
+        return NewNode(iParent, iKind, iWeight, iMinLines, iMinCols);
+    }
+
+    node AddLeaf(node iParent, uint32_t u32Window, int iWeight = 1, int iMinLines = 0, int iMinCols = 0)
+    {
+        node iLeaf = NewNode(iParent, LAYOUT_LEAF, iWeight, iMinLines, iMinCols);
+        if (iLeaf != LAYOUT_NONE)
+            vec_ndNodes[iLeaf].u32Window = u32Window;
+        return iLeaf;
+    }
+
+    // Drop u32Window's leaf, its siblings take over the space
+    bool RemoveLeaf(uint32_t u32Window)
+    {
+        node iLeaf = FindLeaf(u32Window);
+        if (iLeaf == LAYOUT_NONE)
+            return false;
+
+        Node &ndLeaf = vec_ndNodes[iLeaf];
+        std::vector<node> &vec_iSiblings = vec_ndNodes[ndLeaf.iParent].vec_iChildren;
+        vec_iSiblings.erase(std::find(vec_iSiblings.begin(), vec_iSiblings.end(), iLeaf));
+        MarkDirty(ndLeaf.iParent);
+        ndLeaf.iKind = LAYOUT_NONE;
+        ndLeaf.iParent = LAYOUT_NONE;
+        return true;
+    }
+
+    void SetWeight(node iNode, int iWeight)
+    {
+        if (!IsNode(iNode) || vec_ndNodes[iNode].iWeight == iWeight)
+            return;
+        vec_ndNodes[iNode].iWeight = iWeight;
+        MarkDirty(vec_ndNodes[iNode].iParent);
+    }
+
+    node FindLeaf(uint32_t u32Window) const
+    {
+        for (node i = 0; i < static_cast<node>(vec_ndNodes.size()); i++)
+        {
+            if (vec_ndNodes[i].iKind == LAYOUT_LEAF && vec_ndNodes[i].u32Window == u32Window)
+                return i;
+        }
+        return LAYOUT_NONE;
+    }
+
+    // Fit the tree into rcArea; fnPlace(u32Window, rc) for every leaf whose
+    // area differs from the last Arrange
+    template <typename F>
+    void Arrange(const Rect &rcArea, F &&fnPlace)
+    {
+        if (iRoot != LAYOUT_NONE)
+            ArrangeNode(iRoot, rcArea, fnPlace);
+    }
+
+  private:
+    struct Node
+    {
+        int iKind;
+        node iParent;
+        std::vector<node> vec_iChildren;
+        int iWeight;
+        int iMinLines, iMinCols;
+        uint32_t u32Window = 0;
+        Rect rcArea{0, 0, 0, 0}; // as of the last Arrange
+        bool bDirty = true;      // something below changed since
+    };
+
+    std::vector<Node> vec_ndNodes;
+    node iRoot = LAYOUT_NONE;
+
+  private:
+    bool IsNode(node iNode) const
+    {
+        return iNode >= 0 && iNode < static_cast<node>(vec_ndNodes.size()) && vec_ndNodes[iNode].iKind != LAYOUT_NONE;
+    }
+
+    node NewNode(node iParent, int iKind, int iWeight, int iMinLines, int iMinCols)
+    {
+        if (iParent != LAYOUT_NONE && (!IsNode(iParent) || vec_ndNodes[iParent].iKind == LAYOUT_LEAF))
+            return LAYOUT_NONE;
+
+        node iNode = static_cast<node>(vec_ndNodes.size());
+        vec_ndNodes.push_back(Node{iKind, iParent, {}, iWeight, iMinLines, iMinCols});
+        if (iParent != LAYOUT_NONE)
+        {
+            vec_ndNodes[iParent].vec_iChildren.push_back(iNode);
+            MarkDirty(iParent);
+        }
+        return iNode;
+    }
+
+    void MarkDirty(node iNode)
+    {
+        for (; iNode != LAYOUT_NONE && !vec_ndNodes[iNode].bDirty; iNode = vec_ndNodes[iNode].iParent)
+            vec_ndNodes[iNode].bDirty = true;
+    }
+
+    // smallest extent along the rows (bRows) or columns axis the subtree accepts
+    int MinExtent(node iNode, bool bRows) const
+    {
+        const Node &nd = vec_ndNodes[iNode];
+        int iMin = 0;
+        for (node iChild : nd.vec_iChildren)
+        {
+            int iChildMin = MinExtent(iChild, bRows);
+            iMin = (nd.iKind == LAYOUT_ROWS) == bRows ? iMin + iChildMin : std::max(iMin, iChildMin);
+        }
+        return std::max(iMin, bRows ? nd.iMinLines : nd.iMinCols);
+    }
+
+    template <typename F>
+    void ArrangeNode(node iNode, const Rect &rcArea, F &fnPlace)
+    {
+        Node &nd = vec_ndNodes[iNode];
+        bool bMoved = rcArea.left != nd.rcArea.left || rcArea.top != nd.rcArea.top || rcArea.right != nd.rcArea.right ||
+                      rcArea.bottom != nd.rcArea.bottom;
+        if (!bMoved && !nd.bDirty)
+            return;
+        nd.rcArea = rcArea;
+        nd.bDirty = false;
+
+        if (nd.iKind == LAYOUT_LEAF)
+        {
+            if (bMoved)
+                fnPlace(nd.u32Window, rcArea);
+            return;
+        }
+
+        bool bRows = nd.iKind == LAYOUT_ROWS;
+        int iExtent = bRows ? rcArea.bottom - rcArea.top : rcArea.right - rcArea.left;
+        int iCount = static_cast<int>(nd.vec_iChildren.size());
+
+        // minimums first, then the rest by weight; the last weighted child
+        // takes the rounding, and when even the minimums do not fit the
+        // last children give up theirs down to one cell
+        std::vector<int> vec_iSizes(iCount);
+        int iLeft = iExtent, iWeights = 0, iLastWeighted = iCount - 1;
+        for (int i = 0; i < iCount; i++)
+        {
+            const Node &ndChild = vec_ndNodes[nd.vec_iChildren[i]];
+            vec_iSizes[i] = MinExtent(nd.vec_iChildren[i], bRows);
+            iLeft -= vec_iSizes[i];
+            iWeights += ndChild.iWeight;
+            if (ndChild.iWeight > 0)
+                iLastWeighted = i;
+        }
+
+        if (iLeft >= 0)
+        {
+            int iSpare = iLeft;
+            for (int i = 0; i < iCount && iWeights > 0; i++)
+            {
+                int iShare = iSpare * vec_ndNodes[nd.vec_iChildren[i]].iWeight / iWeights;
+                vec_iSizes[i] += iShare;
+                iLeft -= iShare;
+            }
+            if (iCount > 0)
+                vec_iSizes[iLastWeighted] += iLeft;
+        }
+        else
+        {
+            for (int i = iCount - 1; i >= 0 && iLeft < 0; i--)
+            {
+                int iGive = std::min(std::max(vec_iSizes[i] - 1, 0), -iLeft);
+                vec_iSizes[i] -= iGive;
+                iLeft += iGive;
+            }
+        }
+
+        int iPos = bRows ? rcArea.top : rcArea.left;
+        for (int i = 0; i < iCount; i++)
+        {
+            Rect rcChild = bRows ? Rect{rcArea.left, iPos, rcArea.right, iPos + vec_iSizes[i]}
+                                 : Rect{iPos, rcArea.top, iPos + vec_iSizes[i], rcArea.bottom};
+            iPos += vec_iSizes[i];
+            ArrangeNode(nd.vec_iChildren[i], rcChild, fnPlace);
+        }
+    }
+};
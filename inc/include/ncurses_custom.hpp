@@ -1,17 +1,71 @@
 #pragma once
 #include <ncurses.h>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <map>
+#include <memory>
 #include <vector>
-#include <future>
+#include <algorithm>
+#include <functional>
 
 #include "utils.hpp"
 #include "fps.hpp"
+#include "cellgrid.hpp"
+#include "backend.hpp"
+#include "handler_pool.hpp"
+#include "trace.hpp"
+#include "format.hpp"
+#include "slot_map.hpp"
+#include "layout.hpp"
 
 #define WM_UPDATE 1
 #define WM_KEY 10
 #define WM_PRESENT 4
 #define WM_SCREEN_RESIZE 5
+#define WM_HIDDEN 6 // every cell is covered by windows above
+#define WM_SHOWN 7  // some cell is visible again
+#define WM_PASTE 8  // p_strData holds the pasted text
+#define WM_LAYOUT 9 // the layout gave the window a new area, see ApplyLayout
+#define WM_SYNC 11  // u_iParam 1 when the window joined its ShellSyncGroup, 0 when it left
+
+// Mailbox rings are embedded in every window, so they stay small: a
+// handler drains its mailbox whenever it runs, and the broadcasts that
+// come every frame never take a slot, see IsStateMessage. Input past
+// INPUT_MAILBOX_SIZE spills into a locked overflow queue instead of
+// being dropped.
+#define WINDOW_MAILBOX_SIZE 64
+#define INPUT_MAILBOX_SIZE 64
+
+// Input is delivered ahead of everything else and its flips are presented
+// without waiting for the frame interval
+inline bool IsInputMessage(unsigned int u_iMessage)
+{
+    return u_iMessage == WM_KEY || u_iMessage == WM_PASTE;
+}
+
+// These only say that some state changed, so a window holds each as one
+// pending bit: sending it again before the handler got to it changes
+// nothing, and it can never be lost to a full ring. Of WM_SHOWN and
+// WM_HIDDEN only the last one sent is kept, of WM_SYNC the last u_iParam.
+inline bool IsStateMessage(unsigned int u_iMessage)
+{
+    switch (u_iMessage)
+    {
+    case WM_LAYOUT:
+    case WM_SCREEN_RESIZE:
+    case WM_HIDDEN:
+    case WM_SHOWN:
+    case WM_SYNC:
+    case WM_UPDATE:
+    case WM_PRESENT:
+        return true;
+    default:
+        return false;
+    }
+}
 
 struct Msg
 {
@@ -19,6 +73,8 @@ struct Msg
     unsigned int u_iParam;
     void *p_vParam;
     unsigned int u_iTime;
+    std::shared_ptr<const std::string> p_strData; // shared by every window it is sent to
+    int64_t i64StampNs = 0;                       // input: frame_now_ns() when it was read
 
     Msg() : u_iMessage(0), u_iParam(0), p_vParam(nullptr), u_iTime(0) {}
 
@@ -38,94 +94,174 @@ struct Msg
     {
         u_iTime = static_cast<unsigned int>(std::time(nullptr));
     }
+
+    Msg(unsigned int message, std::shared_ptr<const std::string> p_strData)
+        : u_iMessage(message), u_iParam(0), p_vParam(nullptr), p_strData(std::move(p_strData))
+    {
+        u_iTime = static_cast<unsigned int>(std::time(nullptr));
+    }
 };
 
-static std::mutex c_mtxScreenMutex;
-struct AWindow
+#define DC_MOVE 1
+#define DC_TEXT 2
+#define DC_BOX 3
+#define DC_ERASE 4
+#define DC_CLEAR 5
+#define DC_ATTRON 6
+#define DC_ATTROFF 7
+#define DC_ATTRSET 8
+#define DC_HLINE 9
+#define DC_VLINE 10
+#define DC_ERASE_RECT 11
+#define DC_MOVE_WINDOW 12
+#define DC_RESIZE 13
+#define DC_TOUCH 14
+#define DC_UNTOUCH 15
+#define DC_TOUCH_LINE 16
+
+struct DrawCmd
 {
-    WINDOW *p_wndWindow = nullptr;
-    WINDOW *p_wndBuffer = nullptr;
-    int iCols = 0, iLines = 0;
-    int iWindowPosX = 0, iWindowPosY = 0;
+    unsigned int u_iOp;
+    int iArg0, iArg1, iArg2, iArg3;
+    chtype chtArg0, chtArg1;
+};
 
-    bool bSkipFirst = true;
-    bool bUseBuffer = true;
-    const char *c_p_strTitle = "";
-    int i_title_attr = A_BOLD | A_UNDERLINE | COLOR_PAIR(2);
-    int iServerLine = 1;
-    BlockingQueue<Msg> bq_msgMessages;
+// Draw commands recorded by a window handler, replayed by the compositor.
+// Text payloads live in one shared arena so recording a frame does not allocate per call.
+struct DrawCommandBuffer
+{
+    std::vector<DrawCmd> vec_dcCommands;
+    std::string strText;
 
-    AWindow(WINDOW *wnd)
+    void Push(unsigned int u_iOp, int iArg0 = 0, int iArg1 = 0, int iArg2 = 0, int iArg3 = 0,
+              chtype chtArg0 = 0, chtype chtArg1 = 0)
     {
-        p_wndWindow = wnd;
-
-        iCols = getmaxx(p_wndWindow);
-        iLines = getmaxy(p_wndWindow);
-        getbegyx(p_wndWindow, iWindowPosY, iWindowPosX);
-        p_wndBuffer = dupwin(p_wndWindow);
+        vec_dcCommands.push_back(DrawCmd{u_iOp, iArg0, iArg1, iArg2, iArg3, chtArg0, chtArg1});
     }
 
-    ~AWindow()
+    void PushText(const char *c_strText, size_t u_iLen)
     {
-        if (p_wndWindow)
-        {
-            Lock();
+        Push(DC_TEXT, static_cast<int>(strText.size()), static_cast<int>(u_iLen));
+        strText.append(c_strText, u_iLen);
+    }
 
-            delwin(p_wndWindow);
-            p_wndWindow = nullptr;
-            delwin(p_wndBuffer);
-            p_wndBuffer = nullptr;
+    void Append(const DrawCommandBuffer &dcbOther)
+    {
+        int iTextBase = static_cast<int>(strText.size());
 
-            Unlock();
+        for (DrawCmd dc : dcbOther.vec_dcCommands)
+        {
+            if (dc.u_iOp == DC_TEXT)
+                dc.iArg0 += iTextBase;
+            vec_dcCommands.push_back(dc);
         }
+        strText += dcbOther.strText;
     }
 
-    operator WINDOW *() const
+    void Clear()
     {
-        return p_wndWindow;
+        vec_dcCommands.clear();
+        strText.clear();
     }
 
-    void ResetBuffer()
+    bool Empty() const
     {
-        Lock();
+        return vec_dcCommands.empty();
+    }
+};
+
+static std::mutex c_mtxScreenMutex;
+struct AWindow;
+typedef SlotMap<AWindow *>::handle WindowHandle;
 
-        delwin(p_wndBuffer);
-        p_wndBuffer = nullptr;
-        p_wndBuffer = dupwin(p_wndWindow);
+struct AWindow
+{
+    CellGrid cgBuffer;
+    int iCols = 0, iLines = 0;
+    int iWindowPosX = 0, iWindowPosY = 0;
 
-        Unlock();
+    bool bSkipFirst = true;
+    const char *c_p_strTitle = "";
+    int i_title_attr = A_BOLD | A_UNDERLINE | COLOR_PAIR(2);
+    int iServerLine = 1;
+    MpscQueue<Msg, WINDOW_MAILBOX_SIZE> mq_msgMessages;
+    MpscQueue<Msg, INPUT_MAILBOX_SIZE> mq_msgInput; // priority lane, see IsInputMessage
+
+    AWindow(int lines, int cols, int y, int x)
+    {
+        iLines = lines;
+        iCols = cols;
+        iWindowPosY = y;
+        iWindowPosX = x;
+
+        iComposePosY = y;
+        iComposePosX = x;
+        cgBuffer.Resize(lines, cols);
     }
 
+    virtual ~AWindow() {}
+
     void Build()
     {
         AttrOn(i_title_attr);
 
         Move(0, 0);
         HLine(' ', iCols);
-        MVPrint(0, GetTextStartXCentered(p_wndBuffer, c_p_strTitle), c_p_strTitle);
+        MVPrint<"{}">(0, GetTextStartXCentered(iCols, c_p_strTitle), c_p_strTitle);
 
         AttrOff(i_title_attr);
     }
 
-    void Flip(bool bClearAll = false)
+    // Publish the recorded frame to the compositor, which replays it in PresentWindows
+    void Flip()
     {
-        NoOutRefreshBuffer();
+        TraceSpan tsSpan("AWindow::Flip", "window");
+        {
+            std::lock_guard<std::mutex> lock(mtxPending);
 
-        Lock();
+            if (dcbPending.Empty())
+                std::swap(dcbPending, dcbRecording);
+            else
+                dcbPending.Append(dcbRecording);
 
-        copywin(p_wndBuffer, p_wndWindow, 0, 0, 0, 0, iCols - 1, iLines - 1, bClearAll);
+            if (i64PendingInputNs == 0)
+                i64PendingInputNs = i64InputNs;
+        }
 
-        Unlock();
+        dcbRecording.Clear();
+
+        // an answer to input is composed now, not at the next frame deadline
+        if (i64InputNs != 0)
+        {
+            i64InputNs = 0;
+            RequestFrameNow();
+        }
+        else
+            RequestFrame();
+
+        if (i64UpdateStartNs != 0)
+        {
+            fhUpdate.record(frame_now_ns() - i64UpdateStartNs);
+            i64UpdateStartNs = 0;
+        }
     }
 
-    void Present(bool bDoBuffer = false, bool bNoOut = false)
+    // Flip and replay on the calling thread, for windows owned by the compositor
+    void FlipNow()
+    {
+        Flip();
+        Replay();
+    }
+
+    // Returns whether the window's changes should be composited this frame
+    bool Present()
     {
         if (bSkipFirst)
         {
             if (SIR_u_iFrameSkipping > 0)
             {
                 --SIR_u_iFrameSkipping;
-                return;
+                return false;
             }
 
             if (bNoFrame)
@@ -135,7 +271,7 @@ struct AWindow
                     --SIR_u_iExternFrame;
                 }
                 else
-                    return;
+                    return false;
             }
         }
         else
@@ -147,52 +283,54 @@ struct AWindow
                     --SIR_u_iExternFrame;
                 }
                 else
-                    return;
+                    return false;
             }
 
             if (SIR_u_iFrameSkipping > 0)
             {
                 --SIR_u_iFrameSkipping;
-                return;
+                return false;
             }
         }
 
-        if (bDoBuffer)
-        {
-            if (bNoOut)
-                NoOutRefreshBuffer();
-            else
-                RefreshBuffer();
-        }
-        else
-        {
-            if (bNoOut)
-                NoOutRefresh();
-            else
-                Refresh();
-        }
         fcWindowFrameCounter.count();
+        return true;
     }
 
-    void PresentVirtual()
+    void RequestPresent()
     {
-        Present(false, true);
+        SIR_u_iExternFrame++;
+        fcWindowReqFrameCounter.count();
+        RequestFrame();
     }
 
-    void PresentBuffer(bool bNoOut = false)
+    // Ask the compositor for a frame; set by WindowManager::Add
+    void RequestFrame()
     {
-        Present(true, bNoOut);
+        if (fnFrameRequest)
+            fnFrameRequest();
     }
 
-    void PresentBufferVirtual()
+    // Ask for a frame right away, ignoring the frame rate cap
+    void RequestFrameNow()
     {
-        PresentBuffer(true);
+        if (fnFrameRequestNow)
+            fnFrameRequestNow();
+        else
+            RequestFrame();
     }
 
-    void RequestPresent()
+    // For content that answers input outside the draw commands, like a pty's
+    // echo: present it now and count i64StampNs toward key-to-flip latency
+    void AnswerInput(int64_t i64StampNs)
     {
-        SIR_u_iExternFrame++;
-        fcWindowReqFrameCounter.count();
+        {
+            std::lock_guard<std::mutex> lock(mtxPending);
+
+            if (i64PendingInputNs == 0)
+                i64PendingInputNs = i64StampNs;
+        }
+        RequestFrameNow();
     }
 
     void SkipFrame()
@@ -200,24 +338,110 @@ struct AWindow
         SIR_u_iFrameSkipping++;
     }
 
-    void GetMessage(Msg *msgMessage)
+    // Input first, then everything else
+    bool PeekMessage(Msg *msgMessage, bool bNoRemove)
     {
-        *msgMessage = bq_msgMessages.pop();
+        if (mq_msgInput.peek(msgMessage, bNoRemove) || PeekInputOverflow(msgMessage, bNoRemove) ||
+            mq_msgMessages.peek(msgMessage, bNoRemove) || PeekState(msgMessage, bNoRemove))
+        {
+            if (!bNoRemove && msgMessage->i64StampNs != 0 && i64InputNs == 0)
+                i64InputNs = msgMessage->i64StampNs;
+            return true;
+        }
+        return false;
     }
 
-    bool PeekMessage(Msg *msgMessage, bool bNoRemove)
+    // Never blocks the sender; a window that stops reading loses messages
+    // once its mailbox is full, but never input or state messages
+    bool PushMessage(Msg msgMessage)
+    {
+        bool bPushed;
+        if (IsInputMessage(msgMessage.u_iMessage))
+            bPushed = PushInput(msgMessage);
+        else if (IsStateMessage(msgMessage.u_iMessage))
+            bPushed = PushState(msgMessage);
+        else
+            bPushed = mq_msgMessages.try_push(msgMessage);
+        if (!bPushed)
+        {
+            ++u64DroppedMessages;
+            return false;
+        }
+
+        // resume the handler if it is parked in NextMessage
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        void *p_vWaiter = p_vMessageWaiter.exchange(nullptr);
+        if (p_vWaiter != nullptr)
+            p_hpPool->Schedule(std::coroutine_handle<>::from_address(p_vWaiter));
+        return true;
+    }
+
+    // co_await in a handler coroutine: the next message, suspending until one arrives
+    auto NextMessage()
     {
-        return bq_msgMessages.peek(msgMessage, bNoRemove);
+        struct Awaiter
+        {
+            AWindow *p_wnd;
+            Msg msg;
+            bool bHave = false;
+
+            bool await_ready()
+            {
+                // input the previous message left unanswered is not waiting on a Flip any more
+                p_wnd->i64InputNs = 0;
+                bHave = p_wnd->PeekMessage(&msg, false);
+                return bHave;
+            }
+
+            bool await_suspend(std::coroutine_handle<> hCoroutine)
+            {
+                p_wnd->p_vMessageWaiter.store(hCoroutine.address());
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (p_wnd->MessageEmpty())
+                    return true;
+
+                // a message raced in; whoever clears the registration resumes us
+                return p_wnd->p_vMessageWaiter.exchange(nullptr) == nullptr;
+            }
+
+            Msg await_resume()
+            {
+                if (!bHave)
+                    p_wnd->PeekMessage(&msg, false);
+                p_wnd->i64UpdateStartNs = frame_now_ns();
+                return msg;
+            }
+        };
+        return Awaiter{this, Msg{}};
     }
 
-    void PushMessage(Msg msgMessage)
+    // co_await in a handler coroutine: resumes after the next composited frame
+    auto NextFrame()
     {
-        bq_msgMessages.push(msgMessage);
+        struct Awaiter
+        {
+            AWindow *p_wnd;
+
+            bool await_ready()
+            {
+                return p_wnd->p_fsigFrames == nullptr;
+            }
+
+            void await_suspend(std::coroutine_handle<> hCoroutine)
+            {
+                p_wnd->p_fsigFrames->Add(hCoroutine);
+                p_wnd->RequestFrame();
+            }
+
+            void await_resume() {}
+        };
+        return Awaiter{this};
     }
 
     bool MessageEmpty()
     {
-        return bq_msgMessages.empty();
+        return mq_msgInput.empty() && !bInputOverflow.load(std::memory_order_acquire) && mq_msgMessages.empty() &&
+               u32PendingState.load(std::memory_order_acquire) == 0;
     }
 
     bool IsLocked()
@@ -227,7 +451,7 @@ struct AWindow
 
     void Lock()
     {
-        smtxWindowLocking.lock();
+        TracedLock(smtxWindowLocking, "wait SharedMutex");
     }
 
     void Unlock()
@@ -235,676 +459,642 @@ struct AWindow
         smtxWindowLocking.unlock();
     }
 
-    void SetParent(WINDOW *p_wndParentWindow)
-    {
-        Lock();
-
-        SwitchParentWindow(&p_wndWindow, p_wndParentWindow);
-
-        Unlock();
-    }
-
-    void ClearOK(bool bBf)
-    {
-        Lock();
-
-        clearok(p_wndWindow, bBf);
-
-        Unlock();
-    }
-
     void BKGDSet(chtype chtBKGD)
     {
         Lock();
 
-        wbkgdset(p_wndWindow, chtBKGD);
+        chtBkgd = chtBKGD;
 
         Unlock();
     }
 
-    // ASync
+    // Recording (handler side, no locking)
   public:
-    void MVPrint(int y, int x, const char *fmt, ...)
+    // Print<"FPS: {:.1f}">(fFps): format checked by the compiler, see format.hpp
+    template <FormatString Fmt, typename... Args>
+    void Print(const Args &...args)
     {
-        va_list args;
-        va_start(args, fmt);
-
-        auto draw_func = [this, &y, &x, &fmt, &args]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wmove(p_wndBuffer, y, x);
-                VPrintW(p_wndBuffer, fmt, args);
-            }
-            else
-            {
-                wmove(p_wndWindow, y, x);
-                VPrintW(p_wndWindow, fmt, args);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
-
-        va_end(args);
+        FormatBuffer fbText;
+        FormatTo<Fmt>(fbText, args...);
+        dcbRecording.PushText(fbText.arr_chData, fbText.u_iSize);
     }
 
-    void Print(const char *fmt, ...)
+    template <FormatString Fmt, typename... Args>
+    void MVPrint(int y, int x, const Args &...args)
     {
-        va_list args;
-        va_start(args, fmt);
-
-        auto draw_func = [this, &fmt, &args]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                VPrintW(p_wndBuffer, fmt, args);
-            }
-            else
-            {
-                VPrintW(p_wndWindow, fmt, args);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
-
-        va_end(args);
+        dcbRecording.Push(DC_MOVE, y, x);
+        Print<Fmt>(args...);
     }
 
     void Box(chtype chtVerCh, chtype chtHorCh)
     {
-        auto draw_func = [this, &chtVerCh, &chtHorCh]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                box(p_wndBuffer, chtVerCh, chtHorCh);
-            }
-            else
-            {
-                box(p_wndWindow, chtVerCh, chtHorCh);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_BOX, 0, 0, 0, 0, chtVerCh, chtHorCh);
     }
 
     void Erase()
     {
         // clear and fill the window with backcolor
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                werase(p_wndBuffer);
-            }
-            else
-            {
-                werase(p_wndWindow);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_ERASE);
     }
 
     void Clear()
     {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wclear(p_wndBuffer);
-            }
-            else
-            {
-                wclear(p_wndWindow);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
-    }
-
-    void TouchClient()
-    {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            untouchwin(p_wndWindow);
-            touchline(p_wndWindow, iServerLine, iLines - iServerLine);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_CLEAR);
     }
 
     void MoveWindow(int y, int x)
     {
-        auto draw_func = [this, &y, &x]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
+        iWindowPosX = x;
+        iWindowPosY = y;
 
-            mvwin(p_wndWindow, y, x);
-            mvwin(p_wndBuffer, y, x);
-
-            iWindowPosX = x;
-            iWindowPosY = y;
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_MOVE_WINDOW, y, x);
     }
 
     void Resize(int lines, int cols)
     {
-        auto draw_func = [this, &lines, &cols]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            wresize(p_wndWindow, lines, cols);
-            wresize(p_wndBuffer, lines, cols);
-
-            iLines = lines;
-            iCols = cols;
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
-    }
-
-    void Move(int y, int x)
-    {
-        auto draw_func = [this, &y, &x]() {
-            Lock();
+        iLines = lines;
+        iCols = cols;
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wmove(p_wndBuffer, y, x);
-            }
-            else
-            {
-                wmove(p_wndWindow, y, x);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_RESIZE, lines, cols);
     }
 
-    void Refresh()
+    // Called by WindowManager from any thread; the handler picks it up on WM_LAYOUT
+    void SetLayout(const Rect &rc)
     {
-        auto draw_func = [this]() {
-            Lock();
+        std::lock_guard<std::mutex> lock(mtxPending);
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            wrefresh(p_wndWindow);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        rcLayout = rc;
+        bLayoutPending = true;
     }
 
-    void NoOutRefresh()
+    // Handler side: move and resize to the latest area the layout assigned;
+    // false when it is where it already was, so a burst of WM_LAYOUTs costs
+    // one redraw
+    bool ApplyLayout()
     {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            wnoutrefresh(p_wndWindow);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
-    }
-
-    void RefreshBuffer()
-    {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            wrefresh(p_wndBuffer);
+        Rect rc;
+        {
+            std::lock_guard<std::mutex> lock(mtxPending);
 
-            Unlock();
-        };
+            if (!bLayoutPending)
+                return false;
+            rc = rcLayout;
+            bLayoutPending = false;
+        }
 
-        std::async(std::launch::async, draw_func);
+        int lines = std::max(rc.bottom - rc.top, 1);
+        int cols = std::max(rc.right - rc.left, 1);
+        bool bResized = lines != iLines || cols != iCols;
+        bool bMoved = rc.top != iWindowPosY || rc.left != iWindowPosX;
+        if (bResized)
+            Resize(lines, cols);
+        if (bMoved)
+            MoveWindow(rc.top, rc.left);
+        return bResized || bMoved;
     }
 
-    void NoOutRefreshBuffer()
+    void Move(int y, int x)
     {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            wnoutrefresh(p_wndBuffer);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_MOVE, y, x);
     }
 
     template <typename attrT>
     void AttrOn(attrT attrTargs)
     {
-        auto draw_func = [this, &attrTargs]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wattron(p_wndBuffer, attrTargs);
-            }
-            else
-            {
-                wattron(p_wndWindow, attrTargs);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_ATTRON, 0, 0, 0, 0, static_cast<chtype>(attrTargs));
     }
 
     template <typename attrT>
     void AttrOff(attrT attrTargs)
     {
-        auto draw_func = [this, &attrTargs]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wattroff(p_wndBuffer, attrTargs);
-            }
-            else
-            {
-                wattroff(p_wndWindow, attrTargs);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_ATTROFF, 0, 0, 0, 0, static_cast<chtype>(attrTargs));
     }
 
     template <typename attrT>
     void AttrSet(attrT attrTargs)
     {
-        auto draw_func = [this, &attrTargs]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wattrset(p_wndBuffer, attrTargs);
-            }
-            else
-            {
-                wattrset(p_wndWindow, attrTargs);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_ATTRSET, 0, 0, 0, 0, static_cast<chtype>(attrTargs));
     }
 
     void HLine(chtype chtCh, int iNum)
     {
-        auto draw_func = [this, &iNum, &chtCh]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                whline(p_wndBuffer, chtCh, iNum);
-            }
-            else
-            {
-                whline(p_wndWindow, chtCh, iNum);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_HLINE, iNum, 0, 0, 0, chtCh);
     }
 
     void VLine(chtype chtCh, int iNum)
     {
-        auto draw_func = [this, &iNum, &chtCh]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            if (bUseBuffer)
-            {
-                wvline(p_wndBuffer, chtCh, iNum);
-            }
-            else
-            {
-                wvline(p_wndWindow, chtCh, iNum);
-            }
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_VLINE, iNum, 0, 0, 0, chtCh);
     }
 
     void EraseRect(int iX, int iY, int iX1, int iY1, char chBackCh = ' ')
     {
-        auto draw_func = [this, &iX, &iY, &iX1, &iY1, &chBackCh]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            for (int i = iY; i <= iY1; i++)
-            {
-                for (int j = iX; j <= iX1; j++)
-                {
-                    if (bUseBuffer)
-                    {
-                        mvwaddch(p_wndBuffer, i, j, chBackCh);
-                    }
-                    else
-                    {
-                        mvwaddch(p_wndWindow, i, j, chBackCh);
-                    }
-                }
-            }
-
-            Unlock();
-        };
+        dcbRecording.Push(DC_ERASE_RECT, iX, iY, iX1, iY1, static_cast<chtype>(chBackCh));
+    }
 
-        std::async(std::launch::async, draw_func);
+    void TouchClient()
+    {
+        dcbRecording.Push(DC_TOUCH_LINE, iServerLine, iLines - iServerLine);
     }
 
     void UnTouch()
     {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            untouchwin(p_wndWindow);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_UNTOUCH);
     }
 
     void Touch()
     {
-        auto draw_func = [this]() {
-            Lock();
-
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
-
-            touchwin(p_wndWindow);
-
-            Unlock();
-        };
-
-        std::async(std::launch::async, draw_func);
+        dcbRecording.Push(DC_TOUCH);
     }
 
     void TouchLine(int iStart, int iCount)
     {
-        auto draw_func = [this, &iStart, &iCount]() {
-            Lock();
+        dcbRecording.Push(DC_TOUCH_LINE, iStart, iCount);
+    }
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
+    // Compositor side, caller must hold c_mtxScreenMutex
+  public:
+    void Replay()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxPending);
 
-            touchline(p_wndWindow, iStart, iCount);
+            std::swap(dcbPending, dcbReplaying);
+            if (i64ReplayedInputNs == 0)
+                i64ReplayedInputNs = i64PendingInputNs;
+            i64PendingInputNs = 0;
+        }
 
-            Unlock();
-        };
+        if (dcbReplaying.Empty())
+            return;
 
-        std::async(std::launch::async, draw_func);
-    }
+        Lock();
 
-    void UnTouchBuffer()
-    {
-        auto draw_func = [this]() {
-            Lock();
+        for (const DrawCmd &dc : dcbReplaying.vec_dcCommands)
+        {
+            Execute(dc);
+        }
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
+        Unlock();
 
-            untouchwin(p_wndBuffer);
+        dcbReplaying.Clear();
+    }
 
-            Unlock();
-        };
+    // Pull content produced outside the command stream into cgBuffer
+    virtual void Sync() {}
 
-        std::async(std::launch::async, draw_func);
-    }
+  private:
+    // input the ring had no room for, queued behind it; while any is
+    // queued here new input follows it, so input keeps its order
+    std::mutex mtxInputOverflow;
+    std::deque<Msg> dq_msgInputOverflow;
+    std::atomic_bool bInputOverflow{false};
 
-    void TouchBuffer()
+  private:
+    bool PushInput(const Msg &msgMessage)
     {
-        auto draw_func = [this]() {
-            Lock();
+        if (!bInputOverflow.load(std::memory_order_acquire) && mq_msgInput.try_push(msgMessage))
+            return true;
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
+        std::lock_guard<std::mutex> lock(mtxInputOverflow);
+        dq_msgInputOverflow.push_back(msgMessage);
+        bInputOverflow.store(true, std::memory_order_release);
+        return true;
+    }
 
-            touchwin(p_wndBuffer);
+    // consumer only, once the ring is empty
+    bool PeekInputOverflow(Msg *msgMessage, bool bNoRemove)
+    {
+        if (!bInputOverflow.load(std::memory_order_acquire))
+            return false;
 
-            Unlock();
-        };
+        std::lock_guard<std::mutex> lock(mtxInputOverflow);
+        if (dq_msgInputOverflow.empty())
+            return false;
 
-        std::async(std::launch::async, draw_func);
+        *msgMessage = dq_msgInputOverflow.front();
+        if (!bNoRemove)
+        {
+            dq_msgInputOverflow.pop_front();
+            if (dq_msgInputOverflow.empty())
+                bInputOverflow.store(false, std::memory_order_release);
+        }
+        return true;
     }
 
-    void TouchBufferLine(int iStart, int iCount)
+    // pending state messages, one bit per WM_ number; see IsStateMessage
+    std::atomic<uint32_t> u32PendingState{0};
+    std::atomic<unsigned int> u_iSyncParam{0};
+
+    bool PushState(const Msg &msgMessage)
     {
-        auto draw_func = [this, &iStart, &iCount]() {
-            Lock();
+        const uint32_t u32Bit = 1u << msgMessage.u_iMessage;
+        uint32_t u32Clear = 0;
+        if (msgMessage.u_iMessage == WM_SHOWN)
+            u32Clear = 1u << WM_HIDDEN;
+        else if (msgMessage.u_iMessage == WM_HIDDEN)
+            u32Clear = 1u << WM_SHOWN;
+        else if (msgMessage.u_iMessage == WM_SYNC)
+            u_iSyncParam.store(msgMessage.u_iParam, std::memory_order_relaxed);
 
-            std::lock_guard<std::mutex> lock(c_mtxScreenMutex);
+        uint32_t u32Old = u32PendingState.load(std::memory_order_relaxed);
+        while (!u32PendingState.compare_exchange_weak(u32Old, (u32Old & ~u32Clear) | u32Bit, std::memory_order_release,
+                                                      std::memory_order_relaxed))
+        {
+        }
+        return true;
+    }
 
-            touchline(p_wndBuffer, iStart, iCount);
+    // consumer only, after the rings; a new layout is handled before the
+    // redraws it would otherwise cause twice
+    bool PeekState(Msg *msgMessage, bool bNoRemove)
+    {
+        static constexpr unsigned int c_arr_u_iOrder[] = {WM_LAYOUT, WM_SCREEN_RESIZE, WM_HIDDEN, WM_SHOWN,
+                                                          WM_SYNC,   WM_UPDATE,        WM_PRESENT};
 
-            Unlock();
-        };
+        const uint32_t u32Pending = u32PendingState.load(std::memory_order_acquire);
+        if (u32Pending == 0)
+            return false;
 
-        std::async(std::launch::async, draw_func);
+        for (unsigned int u_iMessage : c_arr_u_iOrder)
+        {
+            const uint32_t u32Bit = 1u << u_iMessage;
+            if ((u32Pending & u32Bit) == 0)
+                continue;
+
+            if (!bNoRemove)
+                u32PendingState.fetch_and(~u32Bit, std::memory_order_acquire);
+            *msgMessage = Msg(u_iMessage);
+            if (u_iMessage == WM_SYNC)
+                msgMessage->u_iParam = u_iSyncParam.load(std::memory_order_relaxed);
+            return true;
+        }
+        return false;
     }
 
   public:
     StayInRange<unsigned int> SIR_u_iFrameSkipping = StayInRange<unsigned int>(0);
     StayInRange<unsigned int> SIR_u_iExternFrame = StayInRange<unsigned int>(0);
     bool bNoFrame = false;
+    std::function<void()> fnFrameRequest;
+    std::function<void()> fnFrameRequestNow;
+    std::atomic<uint64_t> u64DroppedMessages{0};
+
+    // handler coroutine plumbing, set by WindowManager::Add
+    WindowHandle hWindow = SLOT_HANDLE_NONE;
+    HandlerPool *p_hpPool = nullptr;
+    FrameSignal *p_fsigFrames = nullptr;
+    std::atomic<void *> p_vMessageWaiter{nullptr};
     frame_counter fcWindowFrameCounter;
     frame_counter fcWindowReqFrameCounter;
+
+    // update: handler time from taking a message to the Flip it caused
+    // draw: compositor time replaying and syncing this window
+    frame_histogram fhUpdate;
+    frame_histogram fhDraw;
+    int64_t i64UpdateStartNs = 0;
+    int64_t i64InputNs = 0;         // oldest input taken and not yet answered by a Flip
+    int64_t i64ReplayedInputNs = 0; // oldest input in what the compositor replayed, for WindowManager
     SharedMutex smtxWindowLocking;
 
-  private:
-    static void SwitchParentWindow(WINDOW **subwin, WINDOW *new_parent)
+    // geometry as of the last replay, owned by the compositor
+    int iComposePosX = 0, iComposePosY = 0;
+    std::vector<Rect> vec_rcGeometryDamage;
+
+    // the parts of GetComposeRect no window above covers, kept by the
+    // compositor; bHidden when there are none
+    std::vector<Rect> vec_rcVisible;
+    std::atomic_bool bHidden{false};
+
+    Rect GetComposeRect() const
+    {
+        return Rect{iComposePosX, iComposePosY, iComposePosX + cgBuffer.iCols, iComposePosY + cgBuffer.iLines};
+    }
+
+  private:
+    DrawCommandBuffer dcbRecording;
+    DrawCommandBuffer dcbPending;
+    DrawCommandBuffer dcbReplaying;
+    std::mutex mtxPending;
+    int64_t i64PendingInputNs = 0; // guarded by mtxPending
+    Rect rcLayout{0, 0, 0, 0};     // guarded by mtxPending
+    bool bLayoutPending = false;
+
+    // grid drawing state, owned by the compositor
+    chtype chtBkgd = 0;
+    chtype chtAttr = 0;
+    int iCurX = 0, iCurY = 0;
+
+  private:
+    static int GetTextStartXCentered(int iWidth, const char *const c_strText)
+    {
+        int text_len = strlen(c_strText);
+        int start_x = (iWidth - text_len) / 2;
+
+        return start_x;
+    }
+
+    void PutCell(int y, int x, chtype chtCh)
     {
-        WINDOW *new_subwin = dupwin(*subwin);
+        // same merge rules as waddch: window attrs and background fill in what the char lacks
+        chtype chtColor = chtCh & A_COLOR;
+        if (!chtColor)
+            chtColor = chtAttr & A_COLOR;
+        if (!chtColor)
+            chtColor = chtBkgd & A_COLOR;
 
-        wclear(new_parent);
-        wrefresh(new_parent);
-        wresize(new_subwin, getmaxy(*subwin), getmaxx(*subwin));
-        touchwin(new_subwin);
-        wrefresh(new_subwin);
-        delwin(*subwin);
+        uint32_t u32Attr = (chtCh | chtAttr | chtBkgd) & (A_ATTRIBUTES & ~A_COLOR);
+        cgBuffer.Set(y, x, chtCh & A_CHARTEXT, u32Attr, PairColor(PAIR_NUMBER(chtColor)));
+    }
 
-        *subwin = new_subwin;
+    void PutBlank(int y, int x)
+    {
+        chtype chtBlank = chtBkgd & A_CHARTEXT;
+        cgBuffer.Set(y, x, chtBlank ? chtBlank : ' ', chtBkgd & (A_ATTRIBUTES & ~A_COLOR), PairColor(PAIR_NUMBER(chtBkgd)));
     }
 
-    static int GetTextStartXCentered(const WINDOW *const p_wndWindow, const char *const c_strText)
+    static uint32_t PairColor(short iPair)
     {
-        int text_len = strlen(c_strText);
-        int start_x = (getmaxx(p_wndWindow) - text_len) / 2;
+        short iFg, iBg;
+        if (iPair == 0 || pair_content(iPair, &iFg, &iBg) == ERR)
+            return 0;
+        return MakeCellColor(iFg, iBg);
+    }
 
-        return start_x;
+    void AddCh(unsigned char chCh)
+    {
+        if (iCurY >= cgBuffer.iLines)
+            return;
+
+        switch (chCh)
+        {
+        case '\n':
+            for (int x = iCurX; x < cgBuffer.iCols; x++)
+            {
+                PutBlank(iCurY, x);
+            }
+            iCurX = 0;
+            if (iCurY < cgBuffer.iLines - 1)
+                ++iCurY;
+            return;
+        case '\r':
+            iCurX = 0;
+            return;
+        case '\b':
+            if (iCurX > 0)
+                --iCurX;
+            return;
+        case '\t':
+            do
+            {
+                AddCh(' ');
+            } while (iCurX % 8 != 0 && iCurX != 0);
+            return;
+        default:
+            break;
+        }
+
+        PutCell(iCurY, iCurX, chCh);
+        if (++iCurX >= cgBuffer.iCols)
+        {
+            iCurX = 0;
+            if (iCurY < cgBuffer.iLines - 1)
+                ++iCurY;
+            else
+                iCurY = cgBuffer.iLines;
+        }
     }
 
-    static void VPrintW(WINDOW *p_wndWindow, const char *fmt, va_list args)
+    void Execute(const DrawCmd &dc)
     {
-        while (*fmt != '\0')
+        switch (dc.u_iOp)
+        {
+        case DC_MOVE:
+            if (cgBuffer.Contains(dc.iArg0, dc.iArg1))
+            {
+                iCurY = dc.iArg0;
+                iCurX = dc.iArg1;
+            }
+            break;
+        case DC_TEXT:
+        {
+            const char *c_p_chText = dcbReplaying.strText.data() + dc.iArg0;
+            for (int i = 0; i < dc.iArg1; i++)
+            {
+                AddCh(c_p_chText[i]);
+            }
+            break;
+        }
+        case DC_BOX:
         {
-            if (*fmt == '%')
+            int iBottom = cgBuffer.iLines - 1, iRight = cgBuffer.iCols - 1;
+            if (iBottom < 1 || iRight < 1)
+                break;
+
+            chtype chtVer = dc.chtArg0 ? dc.chtArg0 : ACS_VLINE;
+            chtype chtHor = dc.chtArg1 ? dc.chtArg1 : ACS_HLINE;
+            for (int x = 1; x < iRight; x++)
+            {
+                PutCell(0, x, chtHor);
+                PutCell(iBottom, x, chtHor);
+            }
+            for (int y = 1; y < iBottom; y++)
             {
-                ++fmt;
-                switch (*fmt)
+                PutCell(y, 0, chtVer);
+                PutCell(y, iRight, chtVer);
+            }
+            PutCell(0, 0, ACS_ULCORNER);
+            PutCell(0, iRight, ACS_URCORNER);
+            PutCell(iBottom, 0, ACS_LLCORNER);
+            PutCell(iBottom, iRight, ACS_LRCORNER);
+            break;
+        }
+        case DC_ERASE:
+        case DC_CLEAR:
+            for (int y = 0; y < cgBuffer.iLines; y++)
+            {
+                for (int x = 0; x < cgBuffer.iCols; x++)
                 {
-                case 'd':
-                    wprintw(p_wndWindow, "%d", va_arg(args, int));
-                    break;
-                case 'f':
-                    wprintw(p_wndWindow, "%f", va_arg(args, double));
-                    break;
-                case 's':
-                    wprintw(p_wndWindow, "%s", va_arg(args, char *));
-                    break;
-                default:
-                    wprintw(p_wndWindow, "?");
-                    break;
+                    PutBlank(y, x);
                 }
             }
-            else
+            iCurY = iCurX = 0;
+            if (dc.u_iOp == DC_CLEAR)
+                cgBuffer.MarkAllDirty();
+            break;
+        case DC_ATTRON:
+            chtAttr |= dc.chtArg0;
+            break;
+        case DC_ATTROFF:
+            chtAttr &= ~dc.chtArg0;
+            break;
+        case DC_ATTRSET:
+            chtAttr = dc.chtArg0;
+            break;
+        case DC_HLINE:
+        {
+            if (iCurY >= cgBuffer.iLines)
+                break;
+
+            chtype chtCh = dc.chtArg0 ? dc.chtArg0 : ACS_HLINE;
+            for (int x = iCurX; x < std::min(iCurX + dc.iArg0, cgBuffer.iCols); x++)
+            {
+                PutCell(iCurY, x, chtCh);
+            }
+            break;
+        }
+        case DC_VLINE:
+        {
+            if (iCurX >= cgBuffer.iCols)
+                break;
+
+            chtype chtCh = dc.chtArg0 ? dc.chtArg0 : ACS_VLINE;
+            for (int y = iCurY; y < std::min(iCurY + dc.iArg0, cgBuffer.iLines); y++)
+            {
+                PutCell(y, iCurX, chtCh);
+            }
+            break;
+        }
+        case DC_ERASE_RECT:
+            for (int i = std::max(dc.iArg1, 0); i <= std::min(dc.iArg3, cgBuffer.iLines - 1); i++)
             {
-                wprintw(p_wndWindow, "%c", *fmt);
+                for (int j = std::max(dc.iArg0, 0); j <= std::min(dc.iArg2, cgBuffer.iCols - 1); j++)
+                {
+                    PutCell(i, j, dc.chtArg0);
+                }
+            }
+            break;
+        case DC_MOVE_WINDOW:
+            vec_rcGeometryDamage.push_back(GetComposeRect());
+            iComposePosY = dc.iArg0;
+            iComposePosX = dc.iArg1;
+            vec_rcGeometryDamage.push_back(GetComposeRect());
+            break;
+        case DC_RESIZE:
+            vec_rcGeometryDamage.push_back(GetComposeRect());
+            cgBuffer.Resize(dc.iArg0, dc.iArg1);
+            iCurY = std::max(0, std::min(iCurY, cgBuffer.iLines - 1));
+            iCurX = std::max(0, std::min(iCurX, cgBuffer.iCols - 1));
+            vec_rcGeometryDamage.push_back(GetComposeRect());
+            break;
+        case DC_TOUCH:
+            cgBuffer.MarkAllDirty();
+            break;
+        case DC_UNTOUCH:
+            cgBuffer.ClearDirty();
+            break;
+        case DC_TOUCH_LINE:
+            for (int y = std::max(dc.iArg0, 0); y < std::min(dc.iArg0 + dc.iArg1, cgBuffer.iLines); y++)
+            {
+                cgBuffer.MarkRowDirty(y);
             }
-            ++fmt;
+            break;
+        default:
+            break;
         }
     }
 };
 
 struct WindowManager
 {
-  private:
-    int iBufferClears = 0;
-    int iBufferErases = 0;
-
   public:
     std::mutex c_mtxScreenBufferMutex;
+    std::mutex mtxLayout; // see GetLayout
 
   public:
     int iScreenCols, iScreenLines;
     int x, y;
 
+    // compositor phases: replaying all windows, composing damage, backend output
+    frame_histogram fhDraw;
+    frame_histogram fhCompose;
+    frame_histogram fhFlip;
+    // from reading a key to the end of the Flip that showed its answer
+    frame_histogram fhInput;
+
   public:
-    WindowManager(AWindow *p_wndScreen, AWindow *p_wndScreenBuffer)
+    WindowManager(WINDOW *p_wndScreen) : nbScreen(p_wndScreen)
     {
         iScreenCols = COLS;
         iScreenLines = LINES;
+        x = y = 0;
 
-        SetScreenBuffer(p_wndScreenBuffer);
         SetScreen(p_wndScreen);
     }
 
-    void SetScreen(AWindow *p_wndScreen)
+    void SetScreen(WINDOW *p_wndScreen)
     {
         Lock();
 
         this->p_wndScreen = p_wndScreen;
+        cgScreen.Resize(iScreenLines, iScreenCols);
+        bFullDamage = true;
 
         Unlock();
     }
 
-    void SetScreenBuffer(AWindow *p_wndScreenBuffer)
+    // Hand the cells that changed since the last flip to the output backend
+    void Flip()
     {
+        TraceSpan tsSpan("WindowManager::Flip", "compositor");
         Lock();
+        TracedLock(c_mtxScreenMutex, "wait c_mtxScreenMutex");
+        std::lock_guard<std::mutex> lock(c_mtxScreenMutex, std::adopt_lock);
 
-        if (this->p_wndScreenBuffer)
+        if (bClearScreen)
         {
-            this->p_wndScreenBuffer->bUseBuffer = bLstWndBUseBuffer;
+            p_sbBackend->Invalidate();
+            cgScreen.MarkAllDirty();
+            bClearScreen = false;
         }
 
-        this->p_wndScreenBuffer = p_wndScreenBuffer;
-        bLstWndBUseBuffer = this->p_wndScreenBuffer->bUseBuffer;
-        this->p_wndScreenBuffer->bUseBuffer = false;
+        int64_t i64Start = frame_now_ns();
+        p_sbBackend->Present(cgScreen);
+        cgScreen.ClearDirty();
+        int64_t i64End = frame_now_ns();
+        fhFlip.record(i64End - i64Start);
+
+        if (i64FrameInputNs != 0)
+        {
+            fhInput.record(i64End - i64FrameInputNs);
+            i64FrameInputNs = 0;
+        }
 
         Unlock();
 
-        SetWindowsParent(*p_wndScreenBuffer);
+        if (p_hpPool != nullptr)
+            fsigFrames.Fire(p_hpPool);
     }
 
-    void Flip()
+    // The backend is not owned; nullptr restores the ncurses backend
+    void SetBackend(ScreenBackend *p_sbBackend)
     {
         Lock();
 
-        copywin(*p_wndScreenBuffer, *p_wndScreen, 0, 0, 0, 0, iScreenCols - 1, iScreenLines - 1, TRUE);
-        p_wndScreen->Present();
-
-        if (iBufferClears > 0)
-        {
-            p_wndScreenBuffer->Clear();
-            p_wndScreenBuffer->PresentVirtual();
-
-            --iBufferClears;
-        }
-        if (iBufferErases > 0)
-        {
-            p_wndScreenBuffer->Erase();
-            p_wndScreenBuffer->PresentVirtual();
-
-            --iBufferErases;
-        }
+        this->p_sbBackend = p_sbBackend ? p_sbBackend : &nbScreen;
+        bClearScreen = true;
 
         Unlock();
     }
 
+    ScreenBackend *GetBackend()
+    {
+        return p_sbBackend;
+    }
+
     void ClearBuffer()
     {
-        ++iBufferClears;
+        bClearScreen = true;
+        bFullDamage = true;
     }
 
     void EraseBuffer()
     {
-        ++iBufferErases;
+        bFullDamage = true;
     }
 
     void Lock()
     {
-        c_mtxScreenBufferMutex.lock();
+        TracedLock(c_mtxScreenBufferMutex, "wait c_mtxScreenBufferMutex");
     }
 
     void Unlock()
@@ -921,17 +1111,22 @@ struct WindowManager
 
     void UpdateScreenSize(bool bPresentWindows = false)
     {
-        iScreenCols = COLS;
-        iScreenLines = LINES;
-
         Lock();
 
-        p_wndScreenBuffer->Resize(iScreenLines, iScreenCols);
-        p_wndScreen->Resize(iScreenLines, iScreenCols);
+        iScreenCols = COLS;
+        iScreenLines = LINES;
+        cgScreen.Resize(iScreenLines, iScreenCols);
+        bClearScreen = true;
+        bFullDamage = true;
+        bCoverageDirty = true;
 
         Unlock();
 
-        BroadcastMessage(Msg{WM_SCREEN_RESIZE});
+        RequestFrame();
+
+        // only the tiled windows whose area changed hear about it, the
+        // compositor redraws everything else from their buffers
+        Relayout();
 
         if (bPresentWindows)
         {
@@ -939,14 +1134,42 @@ struct WindowManager
         }
     }
 
-    void UpdatePos(bool bPresentWindows = false)
+    // Windows in the split tree are tiled over the screen, all others float
+    // above or below them where they put themselves. Edit the tree under
+    // mtxLayout, then Relayout.
+    LayoutTree *GetLayout()
     {
-        Lock();
+        return &ltLayout;
+    }
 
-        p_wndScreenBuffer->MoveWindow(y, x);
-        p_wndScreen->MoveWindow(y, x);
+    // Fit the split tree to the screen and send WM_LAYOUT to every window
+    // whose area changed
+    void Relayout()
+    {
+        TraceSpan tsSpan("WindowManager::Relayout", "layout");
+        std::vector<std::pair<WindowHandle, Rect>> vec_Placed;
+        {
+            std::lock_guard<std::mutex> lock(mtxLayout);
+            ltLayout.Arrange(Rect{0, 0, iScreenCols, iScreenLines},
+                             [&](WindowHandle hWindow, const Rect &rc) { vec_Placed.emplace_back(hWindow, rc); });
+        }
 
-        Unlock();
+        std::lock_guard<std::mutex> lock(mtxWindows);
+        for (auto &[hWindow, rc] : vec_Placed)
+        {
+            AWindow **p_p_awndWindow = smWindows.Get(hWindow);
+            if (p_p_awndWindow == nullptr)
+                continue;
+            (*p_p_awndWindow)->SetLayout(rc);
+            (*p_p_awndWindow)->PushMessage(Msg{WM_LAYOUT});
+        }
+    }
+
+    void UpdatePos(bool bPresentWindows = false)
+    {
+        bFullDamage = true;
+        bCoverageDirty = true;
+        RequestFrame();
 
         BroadcastMessage(Msg{WM_SCREEN_RESIZE});
 
@@ -956,25 +1179,57 @@ struct WindowManager
         }
     }
 
-    void PresentWindows(bool bNewFrame = true, bool bSendUpdateMsg = false, bool bSendPresentMsg = false)
+    void PresentWindows(bool bFullFrame = false, bool bSendUpdateMsg = false, bool bSendPresentMsg = false)
     {
+        TraceSpan tsSpan("WindowManager::PresentWindows", "compositor");
         if (bSendUpdateMsg)
             UpdateWindows();
         if (bSendPresentMsg)
             BroadcastMessage(Msg{WM_PRESENT});
 
         Lock();
-        
-        if (bNewFrame)
-            p_wndScreenBuffer->Erase();
-
-        for (int i = WindowsList.size() - 1; i >= 0; --i)
         {
-            WindowsList[i]->PresentVirtual();
-        }
+            // replay every window's recorded frame in one batch
+            TracedLock(c_mtxScreenMutex, "wait c_mtxScreenMutex");
+            std::lock_guard<std::mutex> lock(c_mtxScreenMutex, std::adopt_lock);
+
+            // every window replays so moves and resizes land even while
+            // hidden, but only visible ones pull in outside content
+            int64_t i64DrawStart = frame_now_ns();
+            vec_i64DrawNs.assign(WindowsList.size(), 0);
+            for (int i = WindowsList.size() - 1; i >= 0; --i)
+            {
+                int64_t i64Start = frame_now_ns();
+                WindowsList[i]->Replay();
+                if (!WindowsList[i]->vec_rcGeometryDamage.empty())
+                    bCoverageDirty = true;
+
+                int64_t &i64InputNs = WindowsList[i]->i64ReplayedInputNs;
+                if (i64InputNs != 0 && (i64FrameInputNs == 0 || i64InputNs < i64FrameInputNs))
+                    i64FrameInputNs = i64InputNs;
+                i64InputNs = 0;
+                vec_i64DrawNs[i] = frame_now_ns() - i64Start;
+            }
+
+            if (bCoverageDirty)
+                UpdateCoverage();
+
+            for (int i = WindowsList.size() - 1; i >= 0; --i)
+            {
+                int64_t i64Start = frame_now_ns();
+                if (!WindowsList[i]->bHidden)
+                    WindowsList[i]->Sync();
+                WindowsList[i]->fhDraw.record(vec_i64DrawNs[i] + frame_now_ns() - i64Start);
+            }
 
-        p_wndScreenBuffer->Touch();
+            if (bFullFrame)
+                bFullDamage = true;
 
+            int64_t i64ComposeStart = frame_now_ns();
+            fhDraw.record(i64ComposeStart - i64DrawStart);
+            Compose();
+            fhCompose.record(frame_now_ns() - i64ComposeStart);
+        }
         Unlock();
     }
 
@@ -983,118 +1238,169 @@ struct WindowManager
         BroadcastMessage(Msg{WM_UPDATE});
     }
 
-    void Add(const char *c_strName, AWindow *p_awndWindow)
+    // Register a window under a name, which is copied; returns its handle,
+    // or SLOT_HANDLE_NONE when the name is taken
+    WindowHandle Add(const char *c_strName, AWindow *p_awndWindow)
     {
         Lock();
 
-        p_awndWindow->SetParent(*p_wndScreenBuffer);
-
-        Unlock();
-
-        Windows[c_strName] = p_awndWindow;
+        WindowHandle hWindow = SLOT_HANDLE_NONE;
+        {
+            std::lock_guard<std::mutex> lock(mtxWindows);
+            if (map_hWindowNames.find(std::string_view(c_strName)) == map_hWindowNames.end())
+                hWindow = smWindows.Insert(p_awndWindow);
+            if (hWindow != SLOT_HANDLE_NONE)
+            {
+                map_hWindowNames.emplace(c_strName, hWindow);
+                p_awndWindow->hWindow = hWindow;
+            }
+        }
 
-        WindowsList.push_back(p_awndWindow);
-    }
+        if (hWindow != SLOT_HANDLE_NONE)
+        {
+            WindowsList.push_back(p_awndWindow);
+            AddDamage(p_awndWindow->GetComposeRect());
+            bCoverageDirty = true;
+            p_awndWindow->fnFrameRequest = fnFrameRequest;
+            p_awndWindow->fnFrameRequestNow = fnFrameRequestNow;
+            p_awndWindow->p_hpPool = p_hpPool;
+            p_awndWindow->p_fsigFrames = p_hpPool != nullptr ? &fsigFrames : nullptr;
+        }
 
-    /*void WindowNoEcho(const char *c_strName)
-    {
-        int x, y, x1, y1;
-        x = Windows[c_strName]->iWindowPosX;
-        y = Windows[c_strName]->iWindowPosY;
-        x1 = x + Windows[c_strName]->iCols;
-        y1 = y + Windows[c_strName]->iLines;
-        
-        Rect r{x, y, x1, y1};
+        Unlock();
 
-        bq_msgPrePresentEvents.push(Msg{
-            WMGR_ERASE_RECT,
-            0,
-            &r});
+        if (hWindow != SLOT_HANDLE_NONE)
+            RequestFrame();
+        return hWindow;
     }
 
-    void WindowNoEcho(AWindow *p_awndWindow)
+    // The window is not deleted; its handle stops resolving
+    bool RemoveWindow(WindowHandle hWindow)
     {
-        int x, y, x1, y1;
-        x = p_awndWindow->iWindowPosX;
-        y = p_awndWindow->iWindowPosY;
-        x1 = x + p_awndWindow->iCols;
-        y1 = y + p_awndWindow->iLines;
-
-        Rect r{x, y, x1, y1};
-
-        bq_msgPrePresentEvents.push(Msg{
-            WMGR_ERASE_RECT,
-            0,
-            &r});
-    }*/
+        Lock();
 
-    void RemoveWindow(const char *c_strName)
-    {
-        // erase from windows
-        auto it = Windows.find(c_strName);
-        if (it != Windows.end())
+        AWindow *p_awndWindow = nullptr;
         {
-            Windows.erase(it);
+            std::lock_guard<std::mutex> lock(mtxWindows);
+            AWindow **p_p_awndWindow = smWindows.Get(hWindow);
+            if (p_p_awndWindow != nullptr)
+            {
+                p_awndWindow = *p_p_awndWindow;
+                smWindows.Erase(hWindow);
+                std::erase_if(map_hWindowNames, [&](const auto &pair) { return pair.second == hWindow; });
+                p_awndWindow->hWindow = SLOT_HANDLE_NONE;
+            }
         }
 
-        // erase from windows list
-        for (auto vit = WindowsList.begin(); vit != WindowsList.end(); vit++)
+        if (p_awndWindow != nullptr)
         {
-            if (*vit == Windows[c_strName])
+            // erase from windows list
+            auto vit = std::find(WindowsList.begin(), WindowsList.end(), p_awndWindow);
+            if (vit != WindowsList.end())
             {
                 WindowsList.erase(vit);
-                break;
             }
+
+            AddDamage(p_awndWindow->GetComposeRect());
+            bCoverageDirty = true;
+        }
+
+        Unlock();
+
+        if (p_awndWindow != nullptr)
+        {
+            bool bTiled;
+            {
+                std::lock_guard<std::mutex> lock(mtxLayout);
+                bTiled = ltLayout.RemoveLeaf(hWindow);
+            }
+            if (bTiled)
+                Relayout();
+            RequestFrame();
         }
+        return p_awndWindow != nullptr;
+    }
+
+    bool RemoveWindow(const char *c_strName)
+    {
+        return RemoveWindow(FindWindow(c_strName));
+    }
+
+    // Handle of the window registered under c_strName, SLOT_HANDLE_NONE if none
+    WindowHandle FindWindow(const char *c_strName)
+    {
+        std::lock_guard<std::mutex> lock(mtxWindows);
+
+        auto it = map_hWindowNames.find(std::string_view(c_strName));
+        return it != map_hWindowNames.end() ? it->second : SLOT_HANDLE_NONE;
+    }
+
+    // nullptr once the window was removed
+    AWindow *GetWindow(WindowHandle hWindow)
+    {
+        std::lock_guard<std::mutex> lock(mtxWindows);
+
+        AWindow **p_p_awndWindow = smWindows.Get(hWindow);
+        return p_p_awndWindow != nullptr ? *p_p_awndWindow : nullptr;
     }
 
     bool GetWindow(const char *c_strName, AWindow **p_awndWindow)
     {
-        if (!IsWindow(c_strName))
+        AWindow *p_awndFound = GetWindow(FindWindow(c_strName));
+        if (p_awndFound == nullptr)
         {
             return false;
         }
 
-        *p_awndWindow = Windows[c_strName];
+        *p_awndWindow = p_awndFound;
         return true;
     }
 
+    bool IsWindow(WindowHandle hWindow)
+    {
+        std::lock_guard<std::mutex> lock(mtxWindows);
+
+        return smWindows.Contains(hWindow);
+    }
+
     bool IsWindow(const char *c_strName)
     {
-        /*auto it = Windows.find(c_strName);
-        if (it != Windows.end())
-        {
-            return true;
-        }
-        
-        return false;*/
+        return FindWindow(c_strName) != SLOT_HANDLE_NONE;
+    }
 
-        return Windows.count(c_strName);
+    void MakeFront(WindowHandle hWindow)
+    {
+        AWindow *p_awndWindow = GetWindow(hWindow);
+        if (p_awndWindow != nullptr)
+            MakeFront(p_awndWindow);
     }
 
     void MakeFront(const char *c_strName)
     {
-        auto it = std::find(WindowsList.begin(), WindowsList.end(), Windows[c_strName]);
-        if (it != WindowsList.end())
-        {
-            WindowsList.erase(it);
-            WindowsList.insert(WindowsList.begin(), Windows[c_strName]);
-        }
+        MakeFront(FindWindow(c_strName));
     }
 
     void MakeFront(AWindow *p_awndWindow)
     {
+        Lock();
+
         auto it = std::find(WindowsList.begin(), WindowsList.end(), p_awndWindow);
         if (it != WindowsList.end())
         {
             WindowsList.erase(it);
             WindowsList.insert(WindowsList.begin(), p_awndWindow);
+            AddDamage(p_awndWindow->GetComposeRect());
+            bCoverageDirty = true;
         }
+
+        Unlock();
+
+        RequestFrame();
     }
 
     bool GetFront(AWindow **p_awndWindow)
     {
-        if (Windows.empty() && WindowsList.empty())
+        if (WindowsList.empty())
             return false;
 
         *p_awndWindow = WindowsList.front();
@@ -1103,27 +1409,33 @@ struct WindowManager
 
     void BroadcastMessage(Msg msgMessage)
     {
-        for (const auto & [ key, value ] : Windows)
+        TraceSpan tsSpan("WindowManager::BroadcastMessage", "message");
+        std::lock_guard<std::mutex> lock(mtxWindows);
+
+        for (AWindow *p_awndWindow : smWindows)
         {
-            if (value != nullptr)
-            {
-                value->PushMessage(msgMessage);
-            }
+            p_awndWindow->PushMessage(msgMessage);
         }
     }
 
-    void SendMessage(const char *c_strName, Msg msgMessage)
+    // false when the window is gone or its mailbox is full
+    bool SendMessage(WindowHandle hWindow, Msg msgMessage)
     {
-        Windows[c_strName]->PushMessage(msgMessage);
+        TraceSpan tsSpan("WindowManager::SendMessage", "message");
+        std::lock_guard<std::mutex> lock(mtxWindows);
+
+        AWindow **p_p_awndWindow = smWindows.Get(hWindow);
+        return p_p_awndWindow != nullptr && (*p_p_awndWindow)->PushMessage(msgMessage);
     }
-    void SendMessage(AWindow *p_awndWindow, Msg msgMessage)
+
+    bool SendMessage(const char *c_strName, Msg msgMessage)
     {
-        p_awndWindow->PushMessage(msgMessage);
+        return SendMessage(FindWindow(c_strName), msgMessage);
     }
 
-    const std::map<const char *, AWindow *> *GetWindowsMap()
+    bool SendMessage(AWindow *p_awndWindow, Msg msgMessage)
     {
-        return &Windows;
+        return SendMessage(p_awndWindow->hWindow, msgMessage);
     }
 
     const std::vector<AWindow *> *GetWindowsList()
@@ -1131,36 +1443,288 @@ struct WindowManager
         return &WindowsList;
     }
 
-    AWindow **GetScreen()
+    WINDOW **GetScreen()
     {
         return &p_wndScreen;
     }
 
-    AWindow **GetScreenBuffer()
+    const CellGrid *GetScreenGrid()
     {
-        return &p_wndScreenBuffer;
+        return &cgScreen;
     }
 
-  private:
-    void SetWindowsParent(WINDOW *p_wndParentWindow)
+    // Mark a screen rectangle for recomposition on the next PresentWindows
+    void Damage(const Rect &rc)
     {
         Lock();
 
-        for (int i = WindowsList.size() - 1; i >= 0; --i)
+        AddDamage(rc);
+
+        Unlock();
+
+        RequestFrame();
+    }
+
+    // Called whenever something needs compositing, from any thread;
+    // fnRequestNow when it answers input and should skip the frame rate cap.
+    // Set them before adding windows; they keep a copy.
+    void SetFrameRequest(std::function<void()> fnRequest, std::function<void()> fnRequestNow = nullptr)
+    {
+        fnFrameRequest = std::move(fnRequest);
+        fnFrameRequestNow = std::move(fnRequestNow);
+    }
+
+    void RequestFrame()
+    {
+        if (fnFrameRequest)
+            fnFrameRequest();
+    }
+
+    // Pool the window handler coroutines run on; like SetFrameRequest, set
+    // it before adding windows
+    void SetHandlerPool(HandlerPool *p_hpPool)
+    {
+        this->p_hpPool = p_hpPool;
+    }
+
+  private:
+    void AddDamage(Rect rc)
+    {
+        rc = RectIntersect(Rect{rc.left + x, rc.top + y, rc.right + x, rc.bottom + y},
+                           Rect{0, 0, iScreenCols, iScreenLines});
+        if (!RectEmpty(rc))
+            vec_rcDamage.push_back(rc);
+    }
+
+    // Turn a presenting window's dirty rows into damage, one rect per run of
+    // rows, cut to the parts of the window that are visible
+    void AddWindowDamage(const AWindow *p_awndWindow)
+    {
+        const auto fnAddRun = [&](const Rect &rcRun) {
+            if (RectEmpty(rcRun))
+                return;
+            for (const Rect &rcVisible : p_awndWindow->vec_rcVisible)
+            {
+                AddDamage(RectIntersect(rcRun, rcVisible));
+            }
+        };
+
+        const CellGrid &cgWindow = p_awndWindow->cgBuffer;
+        Rect rcRun{0, 0, 0, 0};
+
+        for (int wy = 0; wy < cgWindow.iLines; wy++)
         {
-            WindowsList[i]->SetParent(p_wndParentWindow);
+            int iFrom, iTo;
+            if (!cgWindow.DirtySpan(wy, &iFrom, &iTo))
+            {
+                fnAddRun(rcRun);
+                rcRun = Rect{0, 0, 0, 0};
+                continue;
+            }
+
+            Rect rcRow{p_awndWindow->iComposePosX + iFrom, p_awndWindow->iComposePosY + wy,
+                       p_awndWindow->iComposePosX + iTo, p_awndWindow->iComposePosY + wy + 1};
+            rcRun = RectUnion(rcRun, rcRow);
         }
+        fnAddRun(rcRun);
+    }
 
-        Unlock();
+    // Merge touching rects until none touch; past c_iMaxDamageRects fall back to the bounding box
+    void MergeDamage()
+    {
+        const size_t c_iMaxDamageRects = 32;
+
+        bool bMerged = true;
+        while (bMerged)
+        {
+            bMerged = false;
+            for (size_t i = 0; i < vec_rcDamage.size() && !bMerged; i++)
+            {
+                for (size_t j = i + 1; j < vec_rcDamage.size(); j++)
+                {
+                    if (RectTouches(vec_rcDamage[i], vec_rcDamage[j]))
+                    {
+                        vec_rcDamage[i] = RectUnion(vec_rcDamage[i], vec_rcDamage[j]);
+                        vec_rcDamage.erase(vec_rcDamage.begin() + j);
+                        bMerged = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (vec_rcDamage.size() > c_iMaxDamageRects)
+        {
+            Rect rcBounds{0, 0, 0, 0};
+            for (const Rect &rc : vec_rcDamage)
+            {
+                rcBounds = RectUnion(rcBounds, rc);
+            }
+            vec_rcDamage.assign(1, rcBounds);
+        }
+    }
+
+    // Recomposite one damaged rect and copy the cells that differ into
+    // cgScreen, which marks them dirty for Flip. Visible rects never overlap,
+    // so each cell is copied from at most one window.
+    void ComposeRect(const Rect &rc)
+    {
+        int iWidth = rc.right - rc.left;
+
+        for (int sy = rc.top; sy < rc.bottom; sy++)
+        {
+            std::fill_n(cgRow.vec_u32Glyphs.begin(), iWidth, ' ');
+            std::fill_n(cgRow.vec_u32Attrs.begin(), iWidth, 0);
+            std::fill_n(cgRow.vec_u32Colors.begin(), iWidth, 0);
+
+            for (int i = WindowsList.size() - 1; i >= 0; --i)
+            {
+                const AWindow *p_awndWindow = WindowsList[i];
+                const CellGrid &cgWindow = p_awndWindow->cgBuffer;
+                int wy = sy - p_awndWindow->iComposePosY - y;
+                if (p_awndWindow->bHidden || wy < 0 || wy >= cgWindow.iLines)
+                    continue;
+
+                int iLeft = p_awndWindow->iComposePosX + x;
+                for (const Rect &rcVisible : p_awndWindow->vec_rcVisible)
+                {
+                    if (sy < rcVisible.top + y || sy >= rcVisible.bottom + y)
+                        continue;
+
+                    int iFrom = std::max(rc.left, rcVisible.left + x);
+                    int iTo = std::min(rc.right, rcVisible.right + x);
+                    if (iFrom >= iTo)
+                        continue;
+
+                    size_t src = cgWindow.Index(wy, iFrom - iLeft);
+                    std::copy_n(&cgWindow.vec_u32Glyphs[src], iTo - iFrom, &cgRow.vec_u32Glyphs[iFrom - rc.left]);
+                    std::copy_n(&cgWindow.vec_u32Attrs[src], iTo - iFrom, &cgRow.vec_u32Attrs[iFrom - rc.left]);
+                    std::copy_n(&cgWindow.vec_u32Colors[src], iTo - iFrom, &cgRow.vec_u32Colors[iFrom - rc.left]);
+                }
+            }
+
+            for (int sx = rc.left; sx < rc.right; sx++)
+            {
+                int i = sx - rc.left;
+                cgScreen.Set(sy, sx, cgRow.vec_u32Glyphs[i], cgRow.vec_u32Attrs[i], cgRow.vec_u32Colors[i]);
+            }
+        }
+    }
+
+    // Rebuild every window's visible rects front-to-back: each window keeps
+    // what the windows above it leave uncovered. Handlers are told when their
+    // window becomes hidden or shows again.
+    void UpdateCoverage()
+    {
+        bCoverageDirty = false;
+
+        Rect rcScreen{-x, -y, iScreenCols - x, iScreenLines - y};
+        std::vector<Rect> vec_rcCovered, vec_rcRest;
+        for (AWindow *p_awndWindow : WindowsList)
+        {
+            Rect rcWindow = RectIntersect(p_awndWindow->GetComposeRect(), rcScreen);
+            std::vector<Rect> &vec_rcVisible = p_awndWindow->vec_rcVisible;
+
+            vec_rcVisible.clear();
+            if (!RectEmpty(rcWindow))
+                vec_rcVisible.push_back(rcWindow);
+
+            for (const Rect &rcCover : vec_rcCovered)
+            {
+                vec_rcRest.clear();
+                for (const Rect &rcVisible : vec_rcVisible)
+                {
+                    Rect arr_rcPieces[4];
+                    int iPieces = RectSubtract(rcVisible, rcCover, arr_rcPieces);
+                    vec_rcRest.insert(vec_rcRest.end(), arr_rcPieces, arr_rcPieces + iPieces);
+                }
+                vec_rcVisible.swap(vec_rcRest);
+                if (vec_rcVisible.empty())
+                    break;
+            }
+            if (!RectEmpty(rcWindow))
+                vec_rcCovered.push_back(rcWindow);
+
+            bool bHidden = vec_rcVisible.empty();
+            if (bHidden != p_awndWindow->bHidden)
+            {
+                p_awndWindow->bHidden = bHidden;
+                p_awndWindow->PushMessage(Msg(bHidden ? WM_HIDDEN : WM_SHOWN));
+            }
+        }
+    }
+
+    // Collect damage from window geometry changes and presenting windows' dirty
+    // cells, then recomposite only the damaged rects in z-order
+    void Compose()
+    {
+        if (bFullDamage)
+        {
+            vec_rcDamage.assign(1, Rect{0, 0, iScreenCols, iScreenLines});
+            bFullDamage = false;
+        }
+
+        vec_u8Presented.assign(WindowsList.size(), 0);
+        for (size_t i = 0; i < WindowsList.size(); i++)
+        {
+            AWindow *p_awndWindow = WindowsList[i];
+
+            for (const Rect &rc : p_awndWindow->vec_rcGeometryDamage)
+            {
+                AddDamage(rc);
+            }
+            p_awndWindow->vec_rcGeometryDamage.clear();
+
+            // a hidden window keeps its dirty cells until it shows again
+            if (p_awndWindow->bHidden || !p_awndWindow->Present())
+                continue;
+
+            vec_u8Presented[i] = 1;
+            AddWindowDamage(p_awndWindow);
+        }
+
+        MergeDamage();
+
+        if (cgRow.iCols != iScreenCols)
+            cgRow.Resize(1, iScreenCols);
+        for (const Rect &rc : vec_rcDamage)
+        {
+            ComposeRect(rc);
+        }
+        vec_rcDamage.clear();
+
+        for (size_t i = 0; i < WindowsList.size(); i++)
+        {
+            if (vec_u8Presented[i])
+                WindowsList[i]->cgBuffer.ClearDirty();
+        }
     }
 
   private:
-    std::map<const char *, AWindow *> Windows;
-    std::vector<AWindow *> WindowsList;
-    AWindow *p_wndScreenBuffer = nullptr;
-    AWindow *p_wndScreen = nullptr;
+    LayoutTree ltLayout; // guarded by mtxLayout
+
+    // the window table: handles, and names interned to handles for the
+    // string API; guarded by mtxWindows so lookups never wait on a frame
+    std::mutex mtxWindows;
+    SlotMap<AWindow *> smWindows;
+    std::map<std::string, WindowHandle, std::less<>> map_hWindowNames;
+    std::vector<AWindow *> WindowsList; // z-order, front first
+    WINDOW *p_wndScreen = nullptr;
+    NcursesBackend nbScreen;
+    ScreenBackend *p_sbBackend = &nbScreen;
+    std::function<void()> fnFrameRequest;
+    std::function<void()> fnFrameRequestNow;
+    HandlerPool *p_hpPool = nullptr;
+    FrameSignal fsigFrames;
+    int64_t i64FrameInputNs = 0; // oldest input answered in the frame being composed
 
   private:
-    bool bLstWndBUseBuffer = 0;
-    BlockingQueue<Msg> bq_msgPrePresentEvents;
+    CellGrid cgScreen;
+    CellGrid cgRow;
+    std::vector<Rect> vec_rcDamage;
+    std::vector<uint8_t> vec_u8Presented;
+    std::vector<int64_t> vec_i64DrawNs;
+    std::atomic_bool bFullDamage{true};
+    std::atomic_bool bCoverageDirty{true};
+    std::atomic_bool bClearScreen{false};
 };
@@ -0,0 +1,307 @@
+#pragma once
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cerrno>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+
+#define REACTOR_MAX_EVENTS 32
+#define FRAME_NONE_PENDING INT64_MAX // FrameScheduler deadline while no frame is requested
+
+// Single-threaded epoll loop. Handlers run on the thread inside Run(), and
+// may add or remove watches, including their own, while being called.
+class Reactor
+{
+  public:
+    typedef std::function<void(uint32_t)> Handler;
+
+    Reactor()
+    {
+        iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+        iWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        Add(iWakeFd, EPOLLIN, [this](uint32_t) {
+            uint64_t u64Count;
+            while (read(iWakeFd, &u64Count, sizeof(u64Count)) > 0)
+                ;
+        });
+    }
+
+    ~Reactor()
+    {
+        for (auto &[iFd, p_wtWatch] : map_wtWatches)
+        {
+            if (p_wtWatch->bOwned)
+                close(iFd);
+        }
+        if (iWakeFd >= 0)
+            close(iWakeFd);
+        if (iEpollFd >= 0)
+            close(iEpollFd);
+    }
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    bool Add(int iFd, uint32_t u32Events, Handler fnHandler)
+    {
+        return AddWatch(iFd, u32Events, std::move(fnHandler), false);
+    }
+
+    bool Modify(int iFd, uint32_t u32Events)
+    {
+        epoll_event ev{};
+        ev.events = u32Events;
+        ev.data.fd = iFd;
+        return epoll_ctl(iEpollFd, EPOLL_CTL_MOD, iFd, &ev) == 0;
+    }
+
+    void Remove(int iFd)
+    {
+        auto it = map_wtWatches.find(iFd);
+        if (it == map_wtWatches.end())
+            return;
+
+        epoll_ctl(iEpollFd, EPOLL_CTL_DEL, iFd, nullptr);
+        if (it->second->bOwned)
+            close(iFd);
+        map_wtWatches.erase(it);
+    }
+
+    // Deliver a signal through a signalfd. The signal must already be blocked
+    // in every thread, see BlockSignals.
+    int AddSignal(int iSigno, std::function<void(const signalfd_siginfo &)> fnHandler)
+    {
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, iSigno);
+
+        int iFd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (iFd < 0)
+            return -1;
+
+        bool bAdded = AddWatch(iFd, EPOLLIN, [iFd, fnHandler](uint32_t) {
+            signalfd_siginfo ssi;
+            while (read(iFd, &ssi, sizeof(ssi)) == sizeof(ssi))
+                fnHandler(ssi);
+        }, true);
+        return bAdded ? iFd : -1;
+    }
+
+    // A timerfd; zero interval makes it one-shot, re-arm it with ArmTimer
+    int AddTimer(std::chrono::nanoseconds nsFirst, std::chrono::nanoseconds nsInterval, std::function<void()> fnHandler)
+    {
+        int iFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (iFd < 0)
+            return -1;
+
+        bool bAdded = AddWatch(iFd, EPOLLIN, [iFd, fnHandler](uint32_t) {
+            uint64_t u64Expirations;
+            if (read(iFd, &u64Expirations, sizeof(u64Expirations)) == sizeof(u64Expirations))
+                fnHandler();
+        }, true);
+        if (!bAdded)
+            return -1;
+
+        ArmTimer(iFd, nsFirst, nsInterval);
+        return iFd;
+    }
+
+    static bool ArmTimer(int iFd, std::chrono::nanoseconds nsFirst, std::chrono::nanoseconds nsInterval)
+    {
+        itimerspec its{};
+        its.it_value = ToTimespec(nsFirst);
+        its.it_interval = ToTimespec(nsInterval);
+
+        // a zero it_value would disarm the timer
+        if (nsFirst.count() <= 0)
+            its.it_value.tv_nsec = 1;
+        return timerfd_settime(iFd, 0, &its, nullptr) == 0;
+    }
+
+    static bool DisarmTimer(int iFd)
+    {
+        itimerspec its{};
+        return timerfd_settime(iFd, 0, &its, nullptr) == 0;
+    }
+
+    // Interrupt epoll_wait from any thread
+    void Wake()
+    {
+        uint64_t u64One = 1;
+        ssize_t n = write(iWakeFd, &u64One, sizeof(u64One));
+        (void)n;
+    }
+
+    // Wait up to iTimeoutMs (-1 forever) and run the handlers of ready fds
+    bool RunOnce(int iTimeoutMs = -1)
+    {
+        epoll_event arr_evEvents[REACTOR_MAX_EVENTS];
+
+        int n = epoll_wait(iEpollFd, arr_evEvents, REACTOR_MAX_EVENTS, iTimeoutMs);
+        if (n < 0)
+            return errno == EINTR;
+
+        for (int i = 0; i < n; i++)
+        {
+            // the watch may be removed by an earlier handler in this batch
+            auto it = map_wtWatches.find(arr_evEvents[i].data.fd);
+            if (it == map_wtWatches.end())
+                continue;
+
+            std::shared_ptr<Watch> p_wtWatch = it->second;
+            p_wtWatch->fnHandler(arr_evEvents[i].events);
+        }
+        return true;
+    }
+
+    void Run()
+    {
+        bRunning = true;
+        while (bRunning && RunOnce())
+            ;
+    }
+
+    void Stop()
+    {
+        bRunning = false;
+        Wake();
+    }
+
+    // Block iSigno in the calling thread and every thread it creates afterwards
+    static void BlockSignals(std::initializer_list<int> il_iSignals)
+    {
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        for (int iSigno : il_iSignals)
+            sigaddset(&sigs, iSigno);
+        pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+    }
+
+  private:
+    struct Watch
+    {
+        Handler fnHandler;
+        bool bOwned;
+    };
+
+    int iEpollFd = -1;
+    int iWakeFd = -1;
+    std::atomic_bool bRunning{false};
+    std::map<int, std::shared_ptr<Watch>> map_wtWatches;
+
+  private:
+    bool AddWatch(int iFd, uint32_t u32Events, Handler fnHandler, bool bOwned)
+    {
+        epoll_event ev{};
+        ev.events = u32Events;
+        ev.data.fd = iFd;
+        if (epoll_ctl(iEpollFd, EPOLL_CTL_ADD, iFd, &ev) != 0)
+        {
+            if (bOwned)
+                close(iFd);
+            return false;
+        }
+
+        map_wtWatches[iFd] = std::make_shared<Watch>(Watch{std::move(fnHandler), bOwned});
+        return true;
+    }
+
+    static timespec ToTimespec(std::chrono::nanoseconds ns)
+    {
+        timespec ts;
+        ts.tv_sec = ns.count() / 1000000000;
+        ts.tv_nsec = ns.count() % 1000000000;
+        return ts;
+    }
+};
+
+// Runs fnFrame on the reactor thread when someone asks for a frame, at most
+// once per frame interval. Nothing is armed while nobody asks.
+class FrameScheduler
+{
+  public:
+    FrameScheduler(Reactor &rctReactor, int iFps, std::function<void()> fnFrame) : fnFrame(std::move(fnFrame))
+    {
+        SetRate(iFps);
+        iTimerFd = rctReactor.AddTimer(std::chrono::nanoseconds(0), std::chrono::nanoseconds(0), [this]() { OnTimer(); });
+        Reactor::DisarmTimer(iTimerFd);
+    }
+
+    void SetRate(int iFps)
+    {
+        i64IntervalNs = 1000000000 / std::max(iFps, 1);
+    }
+
+    // Thread-safe; requests made while a frame is pending fold into it
+    void Request()
+    {
+        Schedule(i64LastFrameNs.load() + i64IntervalNs);
+    }
+
+    // Thread-safe; a frame as soon as the loop gets to it, pulling in one
+    // already waiting for its deadline. Meant for answers to input.
+    void RequestNow()
+    {
+        Schedule(0);
+    }
+
+  private:
+    std::function<void()> fnFrame;
+    int iTimerFd = -1;
+    int64_t i64IntervalNs = 0;
+    std::atomic<int64_t> i64LastFrameNs{0};
+    std::atomic<int64_t> i64DeadlineNs{FRAME_NONE_PENDING}; // of the pending frame
+
+  private:
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // The deadline only ever moves earlier until the frame runs, so a
+    // request can never push back one made for sooner. Whoever moves it
+    // arms the timer, then checks whether it moved again meanwhile: the
+    // last arming is always for the earliest deadline.
+    void Schedule(int64_t i64Deadline)
+    {
+        int64_t i64Current = i64DeadlineNs.load();
+        do
+        {
+            if (i64Deadline >= i64Current)
+                return;
+        } while (!i64DeadlineNs.compare_exchange_weak(i64Current, i64Deadline));
+
+        while (true)
+        {
+            int64_t i64Delay = i64Deadline - NowNs();
+            Reactor::ArmTimer(iTimerFd, std::chrono::nanoseconds(std::max<int64_t>(i64Delay, 0)),
+                              std::chrono::nanoseconds(0));
+
+            i64Current = i64DeadlineNs.load();
+            if (i64Current >= i64Deadline)
+                return;
+            i64Deadline = i64Current;
+        }
+    }
+
+    void OnTimer()
+    {
+        // stamp and clear first, so requests made while rendering schedule
+        // the next frame one interval from now
+        i64LastFrameNs = NowNs();
+        i64DeadlineNs = FRAME_NONE_PENDING;
+        fnFrame();
+    }
+};
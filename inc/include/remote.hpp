@@ -0,0 +1,614 @@
+#pragma once
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "backend.hpp"
+#include "cellgrid.hpp"
+#include "reactor.hpp"
+
+// Messages between a server owning the panes and the clients attached to
+// it, each: type u8, payload size varint, payload. Numbers in payloads are
+// LEB128 varints.
+#define REMOTE_SIZE 1   // client: its terminal's lines, cols; sent on attach and every resize
+#define REMOTE_KEY 2    // client: a key code as ncurses read it
+#define REMOTE_PASTE 3  // client: pasted text
+#define REMOTE_FRAME 16 // server: cells that changed, see RemoteServer::EncodeFrame
+
+#define REMOTE_READ_CHUNK 65536
+#define REMOTE_MAX_MESSAGE (64 << 20)
+#define REMOTE_CLIENT_BACKLOG (4 << 20) // queued output past which a client skips to a full frame
+#define REMOTE_MAX_LINES 4096           // larger sizes in SIZE or FRAME are protocol errors
+#define REMOTE_MAX_COLS 4096
+
+inline bool RemoteValidSize(uint64_t u64Lines, uint64_t u64Cols)
+{
+    return u64Lines >= 1 && u64Lines <= REMOTE_MAX_LINES && u64Cols >= 1 && u64Cols <= REMOTE_MAX_COLS;
+}
+
+inline void RemoteAppendVarint(std::string &strDst, uint64_t u64Value)
+{
+    do
+    {
+        strDst.push_back(static_cast<char>((u64Value & 0x7f) | (u64Value > 0x7f ? 0x80 : 0)));
+        u64Value >>= 7;
+    } while (u64Value != 0);
+}
+
+// false when the input ends inside the number
+inline bool RemoteReadVarint(const char *&c_p_chAt, const char *c_p_chEnd, uint64_t *p_u64Value)
+{
+    uint64_t u64Value = 0;
+    for (int iShift = 0; iShift < 64 && c_p_chAt < c_p_chEnd; iShift += 7)
+    {
+        uint8_t u8Byte = static_cast<uint8_t>(*c_p_chAt++);
+        u64Value |= static_cast<uint64_t>(u8Byte & 0x7f) << iShift;
+        if ((u8Byte & 0x80) == 0)
+        {
+            *p_u64Value = u64Value;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void RemoteAppendMessage(std::string &strDst, uint8_t u8Type, const char *c_p_chData, size_t u_iSize)
+{
+    strDst.push_back(static_cast<char>(u8Type));
+    RemoteAppendVarint(strDst, u_iSize);
+    strDst.append(c_p_chData, u_iSize);
+}
+
+// Take the complete messages off the front of strIn, fnMessage(type,
+// payload, size) for each; false on a malformed stream
+template <typename F>
+inline bool RemoteParseMessages(std::string &strIn, F &&fnMessage)
+{
+    const char *c_p_chAt = strIn.data();
+    const char *c_p_chEnd = strIn.data() + strIn.size();
+    while (c_p_chAt < c_p_chEnd)
+    {
+        const char *c_p_chMessage = c_p_chAt;
+        uint8_t u8Type = static_cast<uint8_t>(*c_p_chAt++);
+        uint64_t u64Size;
+        if (!RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Size))
+        {
+            c_p_chAt = c_p_chMessage;
+            break;
+        }
+        if (u64Size > REMOTE_MAX_MESSAGE)
+            return false;
+        if (static_cast<uint64_t>(c_p_chEnd - c_p_chAt) < u64Size)
+        {
+            c_p_chAt = c_p_chMessage;
+            break;
+        }
+
+        fnMessage(u8Type, c_p_chAt, static_cast<size_t>(u64Size));
+        c_p_chAt += u64Size;
+    }
+    strIn.erase(0, c_p_chAt - strIn.data());
+    return true;
+}
+
+// One end of a connection: buffered, non-blocking, never raises SIGPIPE
+struct RemotePeer
+{
+    int iFd = -1;
+    std::string strIn;
+    std::string strOut;
+    size_t u_iOutHead = 0;
+
+    // false once the peer is gone
+    bool Read()
+    {
+        char arr_chBuffer[REMOTE_READ_CHUNK];
+        while (1)
+        {
+            ssize_t n = read(iFd, arr_chBuffer, sizeof(arr_chBuffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                return true;
+            if (n <= 0)
+                return false;
+            strIn.append(arr_chBuffer, n);
+        }
+    }
+
+    // false once the peer is gone; what the socket does not take stays queued
+    bool Flush()
+    {
+        while (u_iOutHead < strOut.size())
+        {
+            ssize_t n = send(iFd, strOut.data() + u_iOutHead, strOut.size() - u_iOutHead, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n <= 0)
+                return false;
+            u_iOutHead += n;
+        }
+
+        if (u_iOutHead == strOut.size())
+        {
+            strOut.clear();
+            u_iOutHead = 0;
+        }
+        else if (u_iOutHead > strOut.size() / 2)
+        {
+            strOut.erase(0, u_iOutHead);
+            u_iOutHead = 0;
+        }
+        return true;
+    }
+
+    size_t Pending() const
+    {
+        return strOut.size() - u_iOutHead;
+    }
+};
+
+// The server end: a backend that, instead of drawing, sends the composed
+// screen to every attached client. A frame is encoded once and shared by
+// all clients that are in step; a client that attaches or falls behind
+// by more than REMOTE_CLIENT_BACKLOG gets the whole screen instead.
+struct RemoteServer : ScreenBackend
+{
+    std::function<void(int, int)> fnSize;
+    std::function<void(int)> fnKey;
+    std::function<void(std::shared_ptr<std::string>)> fnPaste;
+    std::function<void()> fnRequestFrame; // a client needs a frame even if nothing changed
+
+    RemoteServer(Reactor &rctReactor) : rctReactor(rctReactor) {}
+
+    ~RemoteServer()
+    {
+        Close();
+    }
+
+    // Replaces a stale socket at c_strPath, but never one a live server
+    // still answers on; only the owner may connect
+    bool Listen(const char *c_strPath)
+    {
+        sockaddr_un saAddr{};
+        if (strlen(c_strPath) >= sizeof(saAddr.sun_path))
+            return false;
+        saAddr.sun_family = AF_UNIX;
+        strcpy(saAddr.sun_path, c_strPath);
+
+        iListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (iListenFd < 0)
+            return false;
+
+        // two servers starting at once are told apart by bind itself
+        if (!RemoveStaleSocket(saAddr))
+        {
+            close(iListenFd);
+            iListenFd = -1;
+            return false;
+        }
+        mode_t mOldMask = umask(0077);
+        bool bBound = bind(iListenFd, reinterpret_cast<sockaddr *>(&saAddr), sizeof(saAddr)) == 0;
+        umask(mOldMask);
+        if (!bBound || listen(iListenFd, 16) != 0)
+        {
+            close(iListenFd);
+            iListenFd = -1;
+            return false;
+        }
+
+        strPath = c_strPath;
+        rctReactor.Add(iListenFd, EPOLLIN, [this](uint32_t) { Accept(); });
+        return true;
+    }
+
+    void Close()
+    {
+        for (auto &[iFd, rpClient] : map_rpClients)
+        {
+            rctReactor.Remove(iFd);
+            close(iFd);
+        }
+        map_rpClients.clear();
+
+        if (iListenFd >= 0)
+        {
+            rctReactor.Remove(iListenFd);
+            close(iListenFd);
+            unlink(strPath.c_str());
+        }
+        iListenFd = -1;
+    }
+
+    size_t Clients() const
+    {
+        return map_rpClients.size();
+    }
+
+    void Present(const CellGrid &cgScreen) override
+    {
+        // clients take a new size only with every cell, see RemoteClient::ApplyFrame
+        if (cgScreen.iLines != iSentLines || cgScreen.iCols != iSentCols)
+        {
+            Invalidate();
+            iSentLines = cgScreen.iLines;
+            iSentCols = cgScreen.iCols;
+        }
+
+        bool bDiffEncoded = false, bFullEncoded = false;
+        for (auto &[iFd, rpClient] : map_rpClients)
+        {
+            // a stalled client gets nothing until it drained, then all of it
+            if (rpClient.Pending() > REMOTE_CLIENT_BACKLOG)
+                rpClient.bFull = true;
+            if (rpClient.Pending() > 0 && rpClient.bFull)
+                continue;
+
+            if (rpClient.bFull)
+            {
+                if (!bFullEncoded)
+                    EncodeFrame(cgScreen, true, strFull);
+                bFullEncoded = true;
+                rpClient.strOut += strFull;
+                rpClient.bFull = false;
+            }
+            else
+            {
+                if (!bDiffEncoded)
+                    EncodeFrame(cgScreen, false, strDiff);
+                bDiffEncoded = true;
+                if (strDiff.empty())
+                    continue;
+                rpClient.strOut += strDiff;
+            }
+
+            ++u64Writes;
+            size_t u_iBefore = rpClient.Pending();
+            FlushClient(iFd, rpClient);
+            u64BytesWritten += u_iBefore - rpClient.Pending();
+        }
+        DropGone();
+    }
+
+    void Invalidate() override
+    {
+        for (auto &[iFd, rpClient] : map_rpClients)
+            rpClient.bFull = true;
+    }
+
+    // A FRAME payload: lines, cols, then runs of row, column, count, each
+    // followed by groups of cells sharing attributes: count, attr, color,
+    // then that many glyphs. bFull sends every cell, otherwise the dirty
+    // ones; strOut is left empty when there is nothing to send.
+    static void EncodeFrame(const CellGrid &cgScreen, bool bFull, std::string &strOut)
+    {
+        std::string strPayload;
+        RemoteAppendVarint(strPayload, cgScreen.iLines);
+        RemoteAppendVarint(strPayload, cgScreen.iCols);
+        size_t u_iHeader = strPayload.size();
+
+        for (int y = 0; y < cgScreen.iLines; y++)
+        {
+            int iFrom = 0, iTo = cgScreen.iCols;
+            if (!bFull && !cgScreen.DirtySpan(y, &iFrom, &iTo))
+                continue;
+
+            // runs of dirty cells; short clean gaps are cheaper to resend
+            // than to start a new run over
+            int x = iFrom;
+            while (x < iTo)
+            {
+                while (x < iTo && !bFull && !cgScreen.IsDirty(y, x))
+                    ++x;
+                if (x >= iTo)
+                    break;
+
+                int iEnd = x + 1, iClean = 0;
+                for (int i = x + 1; i < iTo && iClean < 4; i++)
+                {
+                    if (bFull || cgScreen.IsDirty(y, i))
+                    {
+                        iEnd = i + 1;
+                        iClean = 0;
+                    }
+                    else
+                        ++iClean;
+                }
+
+                RemoteAppendVarint(strPayload, y);
+                RemoteAppendVarint(strPayload, x);
+                RemoteAppendVarint(strPayload, iEnd - x);
+                EncodeCells(cgScreen, y, x, iEnd, strPayload);
+                x = iEnd;
+            }
+        }
+
+        strOut.clear();
+        if (strPayload.size() > u_iHeader || bFull)
+            RemoteAppendMessage(strOut, REMOTE_FRAME, strPayload.data(), strPayload.size());
+    }
+
+  private:
+    struct Client : RemotePeer
+    {
+        bool bFull = true;
+        bool bGone = false;
+    };
+
+    Reactor &rctReactor;
+    int iListenFd = -1;
+    std::string strPath;
+    std::map<int, Client> map_rpClients;
+    std::string strDiff, strFull;
+    int iSentLines = -1, iSentCols = -1;
+
+  private:
+    static void EncodeCells(const CellGrid &cgScreen, int y, int x0, int x1, std::string &strDst)
+    {
+        int x = x0;
+        while (x < x1)
+        {
+            size_t i = cgScreen.Index(y, x);
+            uint32_t u32Attr = cgScreen.vec_u32Attrs[i], u32Color = cgScreen.vec_u32Colors[i];
+            int iEnd = x + 1;
+            while (iEnd < x1 && cgScreen.vec_u32Attrs[i + (iEnd - x)] == u32Attr &&
+                   cgScreen.vec_u32Colors[i + (iEnd - x)] == u32Color)
+                ++iEnd;
+
+            RemoteAppendVarint(strDst, iEnd - x);
+            RemoteAppendVarint(strDst, u32Attr);
+            RemoteAppendVarint(strDst, u32Color);
+            for (int j = x; j < iEnd; j++)
+                RemoteAppendVarint(strDst, cgScreen.vec_u32Glyphs[i + (j - x)]);
+            x = iEnd;
+        }
+    }
+
+    // false when a server is listening at saAddr; a socket nobody listens
+    // on (ECONNREFUSED) is unlinked, anything that is no socket is left alone
+    static bool RemoveStaleSocket(const sockaddr_un &saAddr)
+    {
+        int iProbeFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (iProbeFd < 0)
+            return false;
+        bool bLive = connect(iProbeFd, reinterpret_cast<const sockaddr *>(&saAddr), sizeof(saAddr)) == 0;
+        int iError = errno;
+        close(iProbeFd);
+
+        struct stat stPath;
+        if (!bLive && iError == ECONNREFUSED && lstat(saAddr.sun_path, &stPath) == 0 && S_ISSOCK(stPath.st_mode))
+            unlink(saAddr.sun_path);
+        return !bLive;
+    }
+
+    void Accept()
+    {
+        int iFd;
+        while ((iFd = accept4(iListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            Client &rpClient = map_rpClients[iFd];
+            rpClient.iFd = iFd;
+            rctReactor.Add(iFd, EPOLLIN, [this, iFd](uint32_t u32Events) { OnClient(iFd, u32Events); });
+        }
+    }
+
+    void OnClient(int iFd, uint32_t u32Events)
+    {
+        auto it = map_rpClients.find(iFd);
+        if (it == map_rpClients.end())
+            return;
+        Client &rpClient = it->second;
+
+        if (u32Events & EPOLLOUT)
+        {
+            FlushClient(iFd, rpClient);
+            if (rpClient.Pending() == 0 && rpClient.bFull && fnRequestFrame)
+                fnRequestFrame();
+        }
+
+        if (u32Events & ~EPOLLOUT)
+        {
+            if (!rpClient.Read())
+                rpClient.bGone = true;
+
+            bool bValid = RemoteParseMessages(rpClient.strIn, [&](uint8_t u8Type, const char *c_p_chData, size_t u_iSize) {
+                OnMessage(rpClient, u8Type, c_p_chData, u_iSize);
+            });
+            if (!bValid)
+                rpClient.bGone = true;
+        }
+        DropGone();
+    }
+
+    void OnMessage(Client &rpClient, uint8_t u8Type, const char *c_p_chData, size_t u_iSize)
+    {
+        const char *c_p_chEnd = c_p_chData + u_iSize;
+        uint64_t u64A, u64B;
+
+        switch (u8Type)
+        {
+        case REMOTE_SIZE:
+            if (!RemoteReadVarint(c_p_chData, c_p_chEnd, &u64A) || !RemoteReadVarint(c_p_chData, c_p_chEnd, &u64B) ||
+                !RemoteValidSize(u64A, u64B))
+            {
+                rpClient.bGone = true;
+                break;
+            }
+            if (fnSize)
+                fnSize(static_cast<int>(u64A), static_cast<int>(u64B));
+            // an attaching client announces its size first and wants everything
+            rpClient.bFull = true;
+            if (fnRequestFrame)
+                fnRequestFrame();
+            break;
+        case REMOTE_KEY:
+            if (RemoteReadVarint(c_p_chData, c_p_chEnd, &u64A) && fnKey)
+                fnKey(static_cast<int>(u64A));
+            break;
+        case REMOTE_PASTE:
+            if (fnPaste)
+                fnPaste(std::make_shared<std::string>(c_p_chData, u_iSize));
+            break;
+        default:
+            break;
+        }
+    }
+
+    // watch for writability only while output is queued
+    void FlushClient(int iFd, Client &rpClient)
+    {
+        if (!rpClient.Flush())
+        {
+            rpClient.bGone = true;
+            return;
+        }
+        rctReactor.Modify(iFd, rpClient.Pending() > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+
+    void DropGone()
+    {
+        for (auto it = map_rpClients.begin(); it != map_rpClients.end();)
+        {
+            if (!it->second.bGone)
+            {
+                ++it;
+                continue;
+            }
+            rctReactor.Remove(it->first);
+            close(it->first);
+            it = map_rpClients.erase(it);
+        }
+    }
+};
+
+// The client end: keeps the server's screen in cgScreen, with the cells
+// the last frames changed marked dirty for a backend to present
+struct RemoteClient : RemotePeer
+{
+    CellGrid cgScreen;
+
+    ~RemoteClient()
+    {
+        if (iFd >= 0)
+            close(iFd);
+    }
+
+    bool Connect(const char *c_strPath)
+    {
+        sockaddr_un saAddr{};
+        if (strlen(c_strPath) >= sizeof(saAddr.sun_path))
+            return false;
+        saAddr.sun_family = AF_UNIX;
+        strcpy(saAddr.sun_path, c_strPath);
+
+        iFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (iFd < 0)
+            return false;
+        if (connect(iFd, reinterpret_cast<sockaddr *>(&saAddr), sizeof(saAddr)) != 0)
+        {
+            close(iFd);
+            iFd = -1;
+            return false;
+        }
+        fcntl(iFd, F_SETFL, fcntl(iFd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    void SendSize(int iLines, int iCols)
+    {
+        std::string strPayload;
+        RemoteAppendVarint(strPayload, iLines);
+        RemoteAppendVarint(strPayload, iCols);
+        Send(REMOTE_SIZE, strPayload);
+    }
+
+    void SendKey(int key)
+    {
+        std::string strPayload;
+        RemoteAppendVarint(strPayload, static_cast<uint32_t>(key));
+        Send(REMOTE_KEY, strPayload);
+    }
+
+    void SendPaste(const std::string &strText)
+    {
+        Send(REMOTE_PASTE, strText);
+    }
+
+    // Apply what the server sent; false once it is gone or sent a frame
+    // that breaks the protocol. bFramed tells whether cgScreen changed.
+    bool Pump(bool *p_bFramed)
+    {
+        bool bAlive = Read();
+        bool bFramesValid = true;
+        *p_bFramed = false;
+        bool bValid = RemoteParseMessages(strIn, [&](uint8_t u8Type, const char *c_p_chData, size_t u_iSize) {
+            if (u8Type != REMOTE_FRAME || !bFramesValid)
+                return;
+            bFramesValid = ApplyFrame(c_p_chData, c_p_chData + u_iSize);
+            *p_bFramed |= bFramesValid;
+        });
+        return bAlive && bValid && bFramesValid;
+    }
+
+  private:
+    void Send(uint8_t u8Type, const std::string &strPayload)
+    {
+        RemoteAppendMessage(strOut, u8Type, strPayload.data(), strPayload.size());
+        Flush();
+    }
+
+    // false for a frame no server sends: a size out of bounds, or a new
+    // size without a byte, at least, for each of its cells, which every
+    // whole-screen frame has
+    bool ApplyFrame(const char *c_p_chAt, const char *c_p_chEnd)
+    {
+        uint64_t u64Lines, u64Cols;
+        if (!RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Lines) || !RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Cols) ||
+            !RemoteValidSize(u64Lines, u64Cols))
+            return false;
+        if (static_cast<int>(u64Lines) != cgScreen.iLines || static_cast<int>(u64Cols) != cgScreen.iCols)
+        {
+            if (u64Lines * u64Cols > static_cast<uint64_t>(c_p_chEnd - c_p_chAt))
+                return false;
+            cgScreen.Resize(static_cast<int>(u64Lines), static_cast<int>(u64Cols));
+            cgScreen.MarkAllDirty();
+        }
+
+        uint64_t u64Y, u64X, u64Count, u64Group, u64Attr, u64Color, u64Glyph;
+        while (c_p_chAt < c_p_chEnd)
+        {
+            if (!RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Y) || !RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64X) ||
+                !RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Count))
+                return true;
+
+            uint64_t u64X1 = u64X + u64Count;
+            while (u64X < u64X1)
+            {
+                if (!RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Group) || !RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Attr) ||
+                    !RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Color) || u64Group == 0)
+                    return true;
+
+                for (uint64_t i = 0; i < u64Group && u64X < u64X1; i++, u64X++)
+                {
+                    if (!RemoteReadVarint(c_p_chAt, c_p_chEnd, &u64Glyph))
+                        return true;
+                    if (cgScreen.Contains(static_cast<int>(u64Y), static_cast<int>(u64X)))
+                        cgScreen.Set(static_cast<int>(u64Y), static_cast<int>(u64X), static_cast<uint32_t>(u64Glyph),
+                                     static_cast<uint32_t>(u64Attr), static_cast<uint32_t>(u64Color));
+                }
+            }
+        }
+        return true;
+    }
+};
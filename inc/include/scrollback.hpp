@@ -0,0 +1,294 @@
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "cellgrid.hpp"
+
+#define SB_HOT_LINES 4096
+#define SB_BLOCK_LINES 256
+
+// Pane history. The newest lines stay uncompressed in a ring; once it grows
+// past SB_HOT_LINES the oldest SB_BLOCK_LINES are zlib-compressed into one
+// block and appended to an unlinked temp file that is read back through mmap.
+// Line n of the history lives in block n / SB_BLOCK_LINES, and every block
+// starts with a table of its line sizes, so any position pages in with a
+// single block inflate.
+class Scrollback
+{
+  public:
+    Scrollback()
+    {
+        const char *c_strDir = getenv("TMPDIR");
+        std::string strPath = std::string(c_strDir != nullptr && *c_strDir ? c_strDir : "/tmp") + "/multishell-sb-XXXXXX";
+
+        iFd = mkostemp(&strPath[0], O_CLOEXEC);
+        if (iFd >= 0)
+            unlink(strPath.c_str());
+    }
+
+    ~Scrollback()
+    {
+        if (p_u8Map != nullptr)
+            munmap(p_u8Map, u_iMapSize);
+        if (iFd >= 0)
+            close(iFd);
+    }
+
+    Scrollback(const Scrollback &) = delete;
+    Scrollback &operator=(const Scrollback &) = delete;
+
+    size_t Lines() const
+    {
+        return vec_bkBlocks.size() * SB_BLOCK_LINES + deq_strHot.size();
+    }
+
+    // append row y of a grid as the newest history line
+    void Push(const CellGrid &cgGrid, int y)
+    {
+        int iLength = cgGrid.iCols;
+        size_t i = cgGrid.Index(y, 0);
+        while (iLength > 0 && cgGrid.vec_u32Glyphs[i + iLength - 1] == ' ' && cgGrid.vec_u32Attrs[i + iLength - 1] == 0 &&
+               cgGrid.vec_u32Colors[i + iLength - 1] == 0)
+            --iLength;
+
+        std::string strLine(size_t(iLength) * 3 * sizeof(uint32_t), '\0');
+        uint32_t *p_u32Out = reinterpret_cast<uint32_t *>(&strLine[0]);
+        std::memcpy(p_u32Out, &cgGrid.vec_u32Glyphs[i], iLength * sizeof(uint32_t));
+        std::memcpy(p_u32Out + iLength, &cgGrid.vec_u32Attrs[i], iLength * sizeof(uint32_t));
+        std::memcpy(p_u32Out + 2 * iLength, &cgGrid.vec_u32Colors[i], iLength * sizeof(uint32_t));
+
+        deq_strHot.push_back(std::move(strLine));
+        u64HotBytes += deq_strHot.back().size();
+
+        if (deq_strHot.size() >= SB_HOT_LINES + SB_BLOCK_LINES)
+            Compress();
+    }
+
+    // draw history line u_iLine (0 is the oldest) into row y of cgOut
+    bool ReadLine(size_t u_iLine, CellGrid &cgOut, int y)
+    {
+        const std::string *p_strLine = nullptr;
+        size_t u_iCompressed = vec_bkBlocks.size() * SB_BLOCK_LINES;
+
+        if (u_iLine >= Lines())
+            return false;
+
+        if (u_iLine >= u_iCompressed)
+        {
+            p_strLine = &deq_strHot[u_iLine - u_iCompressed];
+        }
+        else
+        {
+            if (!LoadBlock(u_iLine / SB_BLOCK_LINES))
+                return false;
+            p_strLine = &vec_strCachedLines[u_iLine % SB_BLOCK_LINES];
+        }
+
+        int iLength = static_cast<int>(p_strLine->size() / (3 * sizeof(uint32_t)));
+        const uint32_t *c_p_u32In = reinterpret_cast<const uint32_t *>(p_strLine->data());
+        for (int x = 0; x < cgOut.iCols; x++)
+        {
+            if (x < iLength)
+                cgOut.Set(y, x, c_p_u32In[x], c_p_u32In[iLength + x], c_p_u32In[2 * iLength + x]);
+            else
+                cgOut.Set(y, x, ' ', 0, 0);
+        }
+        return true;
+    }
+
+    void Clear()
+    {
+        deq_strHot.clear();
+        vec_bkBlocks.clear();
+        vec_strCachedLines.clear();
+        iCachedBlock = -1;
+        u64HotBytes = 0;
+        u64StoredBytes = 0;
+        strSpill.clear();
+        if (p_u8Map != nullptr)
+            munmap(p_u8Map, u_iMapSize);
+        p_u8Map = nullptr;
+        u_iMapSize = 0;
+        if (iFd >= 0 && ftruncate(iFd, 0) == 0)
+            u64FileSize = 0;
+    }
+
+  public:
+    uint64_t u64HotBytes = 0;
+    uint64_t u64StoredBytes = 0;
+
+  private:
+    struct Block
+    {
+        uint64_t u64Offset;
+        uint32_t u32CompressedSize;
+        uint32_t u32RawSize;
+    };
+
+    std::deque<std::string> deq_strHot;
+    std::vector<Block> vec_bkBlocks;
+
+    int iFd = -1;
+    uint64_t u64FileSize = 0;
+    uint8_t *p_u8Map = nullptr;
+    size_t u_iMapSize = 0;
+
+    // blocks live here instead when there is no temp file, or it failed
+    std::string strSpill;
+
+    int iCachedBlock = -1;
+    std::vector<std::string> vec_strCachedLines;
+
+  private:
+    void Compress()
+    {
+        // [u32 line sizes][line data...]
+        std::string strRaw(SB_BLOCK_LINES * sizeof(uint32_t), '\0');
+        for (int i = 0; i < SB_BLOCK_LINES; i++)
+        {
+            uint32_t u32Size = static_cast<uint32_t>(deq_strHot[i].size());
+            std::memcpy(&strRaw[i * sizeof(uint32_t)], &u32Size, sizeof(uint32_t));
+            strRaw += deq_strHot[i];
+        }
+
+        uLongf u_lCompressedSize = compressBound(strRaw.size());
+        std::string strCompressed(u_lCompressedSize, '\0');
+        if (compress2(reinterpret_cast<Bytef *>(&strCompressed[0]), &u_lCompressedSize,
+                      reinterpret_cast<const Bytef *>(strRaw.data()), strRaw.size(), Z_BEST_SPEED) != Z_OK)
+            return; // keep the lines hot and try again on the next push
+
+        Store(strCompressed.data(), u_lCompressedSize); // may move what is stored so far
+        vec_bkBlocks.push_back(
+            Block{u64FileSize, static_cast<uint32_t>(u_lCompressedSize), static_cast<uint32_t>(strRaw.size())});
+        u64FileSize += u_lCompressedSize;
+        u64StoredBytes += u_lCompressedSize;
+
+        for (int i = 0; i < SB_BLOCK_LINES; i++)
+        {
+            u64HotBytes -= deq_strHot.front().size();
+            deq_strHot.pop_front();
+        }
+    }
+
+    void Store(const char *c_p_chData, size_t u_iSize)
+    {
+        if (iFd >= 0 && WriteFile(c_p_chData, u_iSize))
+            return;
+
+        // no temp file, or it stopped taking writes (ENOSPC, EIO): blocks
+        // live in memory from now on, so a full disk does not make every
+        // push compress the same block again
+        if (iFd >= 0)
+            MoveToMemory();
+        strSpill.append(c_p_chData, u_iSize);
+    }
+
+    bool WriteFile(const char *c_p_chData, size_t u_iSize)
+    {
+        size_t u_iDone = 0;
+        while (u_iDone < u_iSize)
+        {
+            ssize_t n = pwrite(iFd, c_p_chData + u_iDone, u_iSize - u_iDone, u64FileSize + u_iDone);
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                    continue;
+                return false;
+            }
+            u_iDone += n;
+        }
+        return true;
+    }
+
+    // Carry the blocks stored so far over into strSpill, at the same offsets;
+    // if the file cannot be read back either, its blocks are lost
+    void MoveToMemory()
+    {
+        strSpill.resize(u64FileSize);
+        size_t u_iDone = 0;
+        while (u_iDone < u64FileSize)
+        {
+            ssize_t n = pread(iFd, &strSpill[u_iDone], u64FileSize - u_iDone, u_iDone);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            u_iDone += n;
+        }
+
+        if (u_iDone < u64FileSize)
+        {
+            strSpill.clear();
+            vec_bkBlocks.clear();
+            iCachedBlock = -1;
+            u64StoredBytes = 0;
+            u64FileSize = 0;
+        }
+
+        if (p_u8Map != nullptr)
+            munmap(p_u8Map, u_iMapSize);
+        p_u8Map = nullptr;
+        u_iMapSize = 0;
+        close(iFd);
+        iFd = -1;
+    }
+
+    const uint8_t *BlockData(const Block &bkBlock)
+    {
+        if (iFd < 0)
+            return reinterpret_cast<const uint8_t *>(strSpill.data()) + bkBlock.u64Offset;
+
+        // remap when the block lies past the current mapping
+        if (bkBlock.u64Offset + bkBlock.u32CompressedSize > u_iMapSize)
+        {
+            if (p_u8Map != nullptr)
+                munmap(p_u8Map, u_iMapSize);
+
+            void *p_vMap = mmap(nullptr, u64FileSize, PROT_READ, MAP_SHARED, iFd, 0);
+            p_u8Map = p_vMap == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p_vMap);
+            u_iMapSize = p_u8Map != nullptr ? u64FileSize : 0;
+            if (p_u8Map == nullptr)
+                return nullptr;
+        }
+
+        return p_u8Map + bkBlock.u64Offset;
+    }
+
+    bool LoadBlock(size_t u_iBlock)
+    {
+        if (static_cast<int>(u_iBlock) == iCachedBlock)
+            return true;
+
+        const Block &bkBlock = vec_bkBlocks[u_iBlock];
+        const uint8_t *c_p_u8Data = BlockData(bkBlock);
+        if (c_p_u8Data == nullptr)
+            return false;
+
+        std::string strRaw(bkBlock.u32RawSize, '\0');
+        uLongf u_lRawSize = bkBlock.u32RawSize;
+        if (uncompress(reinterpret_cast<Bytef *>(&strRaw[0]), &u_lRawSize, c_p_u8Data, bkBlock.u32CompressedSize) != Z_OK)
+            return false;
+
+        vec_strCachedLines.resize(SB_BLOCK_LINES);
+        size_t u_iPos = SB_BLOCK_LINES * sizeof(uint32_t);
+        for (int i = 0; i < SB_BLOCK_LINES; i++)
+        {
+            uint32_t u32Size;
+            std::memcpy(&u32Size, &strRaw[i * sizeof(uint32_t)], sizeof(uint32_t));
+            vec_strCachedLines[i].assign(strRaw, u_iPos, u32Size);
+            u_iPos += u32Size;
+        }
+
+        iCachedBlock = static_cast<int>(u_iBlock);
+        return true;
+    }
+};
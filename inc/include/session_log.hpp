@@ -0,0 +1,318 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "reactor.hpp"
+
+#define SESSION_MAGIC "MSHLOG1\n"
+#define SESSION_CHUNK 65536        // payloads are split into records of at most this
+#define SESSION_REPLAY_BATCH 65536 // bytes fed per loop turn when replaying at full speed
+
+// record types
+#define SESSION_PANE 1   // a pane joined: payload is its window name
+#define SESSION_OUTPUT 2 // bytes the pane's pty produced
+#define SESSION_INPUT 3  // bytes written to the pane's pty
+#define SESSION_RESIZE 4 // the pane's terminal changed size, no payload
+
+// A session log is SESSION_MAGIC followed by records of
+//   type u8, pane varint, time delta varint (ns since the previous record),
+//   [lines varint, cols varint for SESSION_PANE and SESSION_RESIZE],
+//   size varint, payload
+// Lines and cols are the terminal's, the size the shell saw. Varints are
+// LEB128, so a typical record header is 4-6 bytes.
+struct SessionEvent
+{
+    uint8_t u8Type = 0;
+    uint32_t u32Pane = 0;
+    int64_t i64TimeNs = 0; // since the first record
+    uint32_t u32Lines = 0, u32Cols = 0; // SESSION_PANE, SESSION_RESIZE
+    std::string strData;
+};
+
+// Appends records from any thread. Panes are numbered in the order they
+// are added.
+class SessionRecorder
+{
+  public:
+    ~SessionRecorder()
+    {
+        Close();
+    }
+
+    bool Open(const char *c_strPath)
+    {
+        p_fOut = fopen(c_strPath, "wb");
+        if (p_fOut == nullptr)
+            return false;
+
+        setvbuf(p_fOut, nullptr, _IOFBF, 1 << 20);
+        fwrite(SESSION_MAGIC, 1, strlen(SESSION_MAGIC), p_fOut);
+        return true;
+    }
+
+    // push buffered records to the file, so a crash loses little
+    void Flush()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (p_fOut != nullptr)
+            fflush(p_fOut);
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (p_fOut != nullptr)
+            fclose(p_fOut);
+        p_fOut = nullptr;
+    }
+
+    uint32_t AddPane(const char *c_strName, int iLines, int iCols)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        uint32_t u32Pane = u32Panes++;
+        if (p_fOut == nullptr)
+            return u32Pane;
+
+        size_t u_iLength = strlen(c_strName);
+        WriteHeader(SESSION_PANE, u32Pane);
+        WriteVarint(iLines);
+        WriteVarint(iCols);
+        WriteVarint(u_iLength);
+        fwrite(c_strName, 1, u_iLength, p_fOut);
+        return u32Pane;
+    }
+
+    void Resize(uint32_t u32Pane, int iLines, int iCols)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (p_fOut == nullptr)
+            return;
+        WriteHeader(SESSION_RESIZE, u32Pane);
+        WriteVarint(iLines);
+        WriteVarint(iCols);
+        WriteVarint(0);
+    }
+
+    void Record(uint8_t u8Type, uint32_t u32Pane, const char *c_p_chData, size_t u_iSize)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (p_fOut == nullptr)
+            return;
+        for (size_t u_iOffset = 0; u_iOffset < u_iSize; u_iOffset += SESSION_CHUNK)
+        {
+            size_t u_iChunk = std::min<size_t>(u_iSize - u_iOffset, SESSION_CHUNK);
+            WriteHeader(u8Type, u32Pane);
+            WriteVarint(u_iChunk);
+            fwrite(c_p_chData + u_iOffset, 1, u_iChunk, p_fOut);
+        }
+    }
+
+  private:
+    std::mutex mtx;
+    FILE *p_fOut = nullptr;
+    uint32_t u32Panes = 0;
+    int64_t i64LastNs = -1;
+
+  private:
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void WriteHeader(uint8_t u8Type, uint32_t u32Pane)
+    {
+        int64_t i64Now = NowNs();
+        int64_t i64Delta = i64LastNs < 0 ? 0 : i64Now - i64LastNs;
+        i64LastNs = i64Now;
+
+        fputc(u8Type, p_fOut);
+        WriteVarint(u32Pane);
+        WriteVarint(static_cast<uint64_t>(i64Delta));
+    }
+
+    void WriteVarint(uint64_t u64Value)
+    {
+        uint8_t arr_u8Bytes[10];
+        int iCount = 0;
+        do
+        {
+            arr_u8Bytes[iCount] = (u64Value & 0x7f) | (u64Value > 0x7f ? 0x80 : 0);
+            u64Value >>= 7;
+            ++iCount;
+        } while (u64Value != 0);
+        fwrite(arr_u8Bytes, 1, iCount, p_fOut);
+    }
+};
+
+class SessionReader
+{
+  public:
+    ~SessionReader()
+    {
+        if (p_fIn != nullptr)
+            fclose(p_fIn);
+    }
+
+    bool Open(const char *c_strPath)
+    {
+        p_fIn = fopen(c_strPath, "rb");
+        if (p_fIn == nullptr)
+            return false;
+
+        char arr_chMagic[sizeof(SESSION_MAGIC) - 1];
+        return fread(arr_chMagic, 1, sizeof(arr_chMagic), p_fIn) == sizeof(arr_chMagic) &&
+               memcmp(arr_chMagic, SESSION_MAGIC, sizeof(arr_chMagic)) == 0;
+    }
+
+    // false at the end of the log or at a truncated record
+    bool Next(SessionEvent *p_seEvent)
+    {
+        int iType = p_fIn != nullptr ? fgetc(p_fIn) : EOF;
+        uint64_t u64Pane, u64Delta, u64Size;
+        if (iType == EOF || !ReadVarint(&u64Pane) || !ReadVarint(&u64Delta))
+            return false;
+
+        i64TimeNs += static_cast<int64_t>(u64Delta);
+        p_seEvent->u8Type = static_cast<uint8_t>(iType);
+        p_seEvent->u32Pane = static_cast<uint32_t>(u64Pane);
+        p_seEvent->i64TimeNs = i64TimeNs;
+
+        if (iType == SESSION_PANE || iType == SESSION_RESIZE)
+        {
+            uint64_t u64Lines, u64Cols;
+            if (!ReadVarint(&u64Lines) || !ReadVarint(&u64Cols))
+                return false;
+            p_seEvent->u32Lines = static_cast<uint32_t>(u64Lines);
+            p_seEvent->u32Cols = static_cast<uint32_t>(u64Cols);
+        }
+
+        if (!ReadVarint(&u64Size) || u64Size > SESSION_CHUNK * 2)
+            return false;
+        p_seEvent->strData.resize(u64Size);
+        return fread(&p_seEvent->strData[0], 1, u64Size, p_fIn) == u64Size;
+    }
+
+    // The whole log, for replays that must not touch the disk while timed
+    static bool ReadAll(const char *c_strPath, std::vector<SessionEvent> *p_vec_seEvents)
+    {
+        SessionReader srdReader;
+        if (!srdReader.Open(c_strPath))
+            return false;
+
+        SessionEvent seEvent;
+        while (srdReader.Next(&seEvent))
+            p_vec_seEvents->push_back(seEvent);
+        return true;
+    }
+
+  private:
+    FILE *p_fIn = nullptr;
+    int64_t i64TimeNs = 0;
+
+  private:
+    bool ReadVarint(uint64_t *p_u64Value)
+    {
+        uint64_t u64Value = 0;
+        for (int iShift = 0; iShift < 64; iShift += 7)
+        {
+            int iByte = fgetc(p_fIn);
+            if (iByte == EOF)
+                return false;
+
+            u64Value |= static_cast<uint64_t>(iByte & 0x7f) << iShift;
+            if ((iByte & 0x80) == 0)
+            {
+                *p_u64Value = u64Value;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Plays a log back on a reactor, either at the pace it was recorded or as
+// fast as the loop turns: then SESSION_REPLAY_BATCH bytes per turn, so
+// frames and input still get their share.
+class SessionReplay
+{
+  public:
+    typedef std::function<void(const SessionEvent &)> EventHandler;
+
+    SessionReplay(Reactor &rctReactor, std::vector<SessionEvent> vec_seEvents, bool bRealTime, EventHandler fnEvent,
+                  std::function<void()> fnDone)
+        : rctReactor(rctReactor), vec_seEvents(std::move(vec_seEvents)), bRealTime(bRealTime), fnEvent(std::move(fnEvent)),
+          fnDone(std::move(fnDone))
+    {
+        i64StartNs = NowNs();
+        iTimerFd = rctReactor.AddTimer(std::chrono::nanoseconds(0), std::chrono::nanoseconds(0), [this]() { OnTimer(); });
+    }
+
+    bool Done() const
+    {
+        return u_iNext >= vec_seEvents.size();
+    }
+
+    // output bytes fed and wall time taken, for throughput
+    uint64_t u64Bytes = 0;
+    int64_t i64ElapsedNs = 0;
+
+  private:
+    Reactor &rctReactor;
+    std::vector<SessionEvent> vec_seEvents;
+    bool bRealTime;
+    EventHandler fnEvent;
+    std::function<void()> fnDone;
+    size_t u_iNext = 0;
+    int64_t i64StartNs = 0;
+    int iTimerFd = -1;
+
+  private:
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void OnTimer()
+    {
+        int64_t i64Elapsed = NowNs() - i64StartNs;
+        size_t u_iBatch = 0;
+
+        while (!Done())
+        {
+            const SessionEvent &seEvent = vec_seEvents[u_iNext];
+            if (bRealTime ? seEvent.i64TimeNs > i64Elapsed : u_iBatch >= SESSION_REPLAY_BATCH)
+                break;
+
+            fnEvent(seEvent);
+            if (seEvent.u8Type == SESSION_OUTPUT)
+                u64Bytes += seEvent.strData.size();
+            u_iBatch += seEvent.strData.size();
+            ++u_iNext;
+        }
+
+        if (Done())
+        {
+            i64ElapsedNs = NowNs() - i64StartNs;
+            rctReactor.Remove(iTimerFd);
+            if (fnDone)
+                fnDone();
+            return;
+        }
+
+        int64_t i64Delay = bRealTime ? vec_seEvents[u_iNext].i64TimeNs - i64Elapsed : 0;
+        Reactor::ArmTimer(iTimerFd, std::chrono::nanoseconds(i64Delay), std::chrono::nanoseconds(0));
+    }
+};
@@ -0,0 +1,610 @@
+#pragma once
+#include <ncurses.h>
+#include <pty.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ncurses_custom.hpp"
+#include "vtparser.hpp"
+#include "scrollback.hpp"
+#include "session_log.hpp"
+
+#define SHELL_READ_CHUNK 65536
+#define SHELL_PUMP_CHUNKS 4 // per Pump(), so one busy pane cannot starve the loop
+
+// An AWindow hosting a shell on a pty. Whoever watches iMasterFd calls Pump()
+// when it is readable, which feeds the shell's output through a VtTerminal; Sync() moves the changed cells into cgBuffer
+// below the title line on the compositor thread. Lines scrolled off the top
+// go to sbHistory, browsed with shift+PgUp/PgDn. Input the pty cannot take
+// yet is queued; the watcher is told through fnOutputBlocked to wait for
+// the fd to become writable and call FlushOutput(). With a recorder set,
+// everything read from and written to the pty is also logged.
+struct ShellWindow : AWindow
+{
+    VtTerminal vtTerminal;
+    Scrollback sbHistory;
+    std::mutex mtxTerminal;
+
+    int iMasterFd = -1;
+    pid_t pidShell = -1;
+    std::atomic_bool bExited{false};
+    std::function<void(bool)> fnOutputBlocked;
+
+    // flood statistics: bytes run through the terminal, and screens (the
+    // terminal after one read) that no frame showed because a later read
+    // replaced them first; read chunks, not frames
+    std::atomic<uint64_t> u64BytesParsed{0};
+    std::atomic<uint64_t> u64ScreensSkipped{0};
+
+    // bSpawn false leaves the pane without a pty, for output that is Fed
+    ShellWindow(int lines, int cols, int y, int x, const char *c_strShell = nullptr, bool bSpawn = true)
+        : AWindow(lines, cols, y, x), vtTerminal(lines - 1, cols)
+    {
+        vtTerminal.p_sbHistory = &sbHistory;
+        if (!bSpawn)
+            return;
+        Spawn(c_strShell);
+
+        if (iMasterFd < 0)
+            bExited = true;
+    }
+
+    ~ShellWindow()
+    {
+        if (pidShell > 0)
+            kill(pidShell, SIGHUP);
+        if (iMasterFd >= 0)
+            close(iMasterFd);
+        if (pidShell > 0)
+            waitpid(pidShell, nullptr, 0);
+    }
+
+    // Log the pane's pty traffic and terminal size to p_srRecorder from now on
+    void Record(SessionRecorder *p_srRecorder, const char *c_strName)
+    {
+        std::lock_guard<std::mutex> lock(mtxTerminal);
+
+        u32RecordPane = p_srRecorder->AddPane(c_strName, vtTerminal.cgScreen.iLines, vtTerminal.cgScreen.iCols);
+        this->p_srRecorder = p_srRecorder;
+    }
+
+    // For replays: the terminal takes the size a log recorded and keeps it,
+    // whatever area the layout gives the window, so output fed after this
+    // parses the way it did when it was recorded
+    void PinTerminal(int iTermLines, int iTermCols)
+    {
+        std::lock_guard<std::mutex> lock(mtxTerminal);
+
+        iPinnedLines = std::max(iTermLines, 1);
+        iPinnedCols = std::max(iTermCols, 1);
+        if (iPinnedLines != vtTerminal.cgScreen.iLines || iPinnedCols != vtTerminal.cgScreen.iCols)
+            vtTerminal.Resize(iPinnedLines, iPinnedCols);
+        bBlankMargins = true;
+        bTermDirty = true;
+        RequestFrame();
+    }
+
+    // Never blocks; behind earlier queued input, bytes wait their turn.
+    // With nothing queued they go straight from c_p_chData to the pty, only
+    // what the pty does not take is copied
+    void SendBytes(const char *c_p_chData, size_t u_iSize)
+    {
+        std::lock_guard<std::mutex> lock(mtxOutput);
+
+        if (p_srRecorder != nullptr)
+            p_srRecorder->Record(SESSION_INPUT, u32RecordPane, c_p_chData, u_iSize);
+        size_t u_iWritten = strOutput.empty() ? WriteLocked(c_p_chData, u_iSize) : 0;
+        strOutput.append(c_p_chData + u_iWritten, u_iSize - u_iWritten);
+        FlushOutputLocked();
+    }
+
+    // Input typed into another pane of a ShellSyncGroup; snaps the view back
+    // to the live screen as typing does
+    void SendSynced(const std::string &strInput)
+    {
+        ScrollView(-iViewOffset);
+        SendBytes(strInput.data(), strInput.size());
+    }
+
+    // Paste text the way a terminal does: newlines as carriage returns, and
+    // wrapped in bracketed-paste markers when the application asked for them
+    void SendPaste(const std::string &strText)
+    {
+        ScrollView(-iViewOffset);
+        AwaitEcho();
+        bool bBracketed = vtTerminal.bBracketedPaste;
+
+        std::lock_guard<std::mutex> lock(mtxOutput);
+
+        size_t u_iStart = strOutput.size();
+        strOutput.reserve(strOutput.size() + strText.size() + 12);
+        if (bBracketed)
+            strOutput.append("\x1b[200~");
+        for (size_t i = 0; i < strText.size(); i++)
+        {
+            // an end marker inside the text would let it out of the paste
+            if (bBracketed && strText.compare(i, 6, "\x1b[201~") == 0)
+            {
+                i += 5;
+                continue;
+            }
+            strOutput.push_back(strText[i] == '\n' ? '\r' : strText[i]);
+        }
+        if (bBracketed)
+            strOutput.append("\x1b[201~");
+
+        if (p_srRecorder != nullptr)
+            p_srRecorder->Record(SESSION_INPUT, u32RecordPane, strOutput.data() + u_iStart, strOutput.size() - u_iStart);
+        FlushOutputLocked();
+    }
+
+    // Write queued input, called by the watcher when iMasterFd is writable
+    void FlushOutput()
+    {
+        std::lock_guard<std::mutex> lock(mtxOutput);
+
+        FlushOutputLocked();
+    }
+
+    // Translate an ncurses key code into what the shell expects on its tty
+    void SendKey(int key)
+    {
+        if (key == KEY_SPREVIOUS || key == KEY_SNEXT)
+        {
+            int iPage = std::max((iLines - iServerLine) / 2, 1);
+            ScrollView(key == KEY_SPREVIOUS ? iPage : -iPage);
+            return;
+        }
+        ScrollView(-iViewOffset); // typing snaps back to the live screen
+        AwaitEcho();
+
+        std::string strKey;
+        if (KeySequence(key, vtTerminal.bAppCursor, &strKey))
+            SendBytes(strKey.data(), strKey.size());
+    }
+
+    // Append what key sends to a tty in the given cursor key mode; false for
+    // keys that never reach the shell
+    static bool KeySequence(int key, bool bAppCursor, std::string *p_strOut)
+    {
+        const char *c_p_strSeq = nullptr;
+
+        switch (key)
+        {
+        case KEY_UP:
+            c_p_strSeq = bAppCursor ? "\x1bOA" : "\x1b[A";
+            break;
+        case KEY_DOWN:
+            c_p_strSeq = bAppCursor ? "\x1bOB" : "\x1b[B";
+            break;
+        case KEY_RIGHT:
+            c_p_strSeq = bAppCursor ? "\x1bOC" : "\x1b[C";
+            break;
+        case KEY_LEFT:
+            c_p_strSeq = bAppCursor ? "\x1bOD" : "\x1b[D";
+            break;
+        case KEY_HOME:
+            c_p_strSeq = bAppCursor ? "\x1bOH" : "\x1b[H";
+            break;
+        case KEY_END:
+            c_p_strSeq = bAppCursor ? "\x1bOF" : "\x1b[F";
+            break;
+        case KEY_IC:
+            c_p_strSeq = "\x1b[2~";
+            break;
+        case KEY_DC:
+            c_p_strSeq = "\x1b[3~";
+            break;
+        case KEY_PPAGE:
+            c_p_strSeq = "\x1b[5~";
+            break;
+        case KEY_NPAGE:
+            c_p_strSeq = "\x1b[6~";
+            break;
+        case KEY_BACKSPACE:
+            c_p_strSeq = "\x7f";
+            break;
+        case KEY_ENTER:
+        case '\n':
+            c_p_strSeq = "\r";
+            break;
+        default:
+            break;
+        }
+
+        if (c_p_strSeq != nullptr)
+        {
+            p_strOut->append(c_p_strSeq);
+        }
+        else if (key >= KEY_F(1) && key <= KEY_F(12))
+        {
+            static const char *c_arrFunctionKeys[] = {"\x1bOP",   "\x1bOQ",   "\x1bOR",   "\x1bOS",
+                                                      "\x1b[15~", "\x1b[17~", "\x1b[18~", "\x1b[19~",
+                                                      "\x1b[20~", "\x1b[21~", "\x1b[23~", "\x1b[24~"};
+            p_strOut->append(c_arrFunctionKeys[key - KEY_F(1)]);
+        }
+        else if (key >= 0 && key < 0x100)
+        {
+            p_strOut->push_back(static_cast<char>(key));
+        }
+        else
+            return false;
+        return true;
+    }
+
+    // Read what the shell has written so far; false once it has exited
+    bool Pump()
+    {
+        char arr_chBuffer[SHELL_READ_CHUNK];
+        std::string strReply;
+
+        for (int i = 0; i < SHELL_PUMP_CHUNKS; i++)
+        {
+            ssize_t n = read(iMasterFd, arr_chBuffer, sizeof(arr_chBuffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n <= 0)
+            {
+                // EIO once the shell has gone
+                std::lock_guard<std::mutex> lock(mtxTerminal);
+                vtTerminal.Feed("\r\n[process exited]", 18);
+                bExited = true;
+                bTermDirty = true;
+                RequestFrame();
+                return false;
+            }
+
+            if (p_srRecorder != nullptr)
+                p_srRecorder->Record(SESSION_OUTPUT, u32RecordPane, arr_chBuffer, n);
+            Feed(arr_chBuffer, n, &strReply);
+        }
+
+        if (!strReply.empty())
+            SendBytes(strReply.data(), strReply.size());
+
+        int64_t i64EchoNs = i64EchoInputNs.exchange(0);
+        if (i64EchoNs != 0)
+            AnswerInput(i64EchoNs);
+        else
+            RequestFrame();
+        return true;
+    }
+
+    // Run output through the terminal as if the shell had written it;
+    // answers to terminal queries are appended to p_strReply
+    void Feed(const char *c_p_chData, size_t u_iSize, std::string *p_strReply = nullptr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtxTerminal);
+            vtTerminal.Feed(c_p_chData, u_iSize);
+            if (p_strReply != nullptr)
+                p_strReply->append(vtTerminal.strReply);
+            vtTerminal.strReply.clear();
+        }
+        u64BytesParsed.fetch_add(u_iSize, std::memory_order_relaxed);
+        u32ScreensPending.fetch_add(1, std::memory_order_relaxed);
+        bTermDirty = true;
+    }
+
+    // Move the view iDelta lines back into history (forward when negative)
+    void ScrollView(int iDelta)
+    {
+        int iOffset = std::max(iViewOffset + iDelta, 0);
+        if (iOffset != iViewOffset)
+        {
+            iViewOffset = iOffset;
+            bTermDirty = true;
+            RequestFrame();
+        }
+    }
+
+    // Compositor side, caller must hold c_mtxScreenMutex
+    void Sync() override
+    {
+        int iTermLines = std::max(cgBuffer.iLines - iServerLine, 1);
+        int iTermCols = std::max(cgBuffer.iCols, 1);
+        if (iPinnedLines > 0)
+        {
+            iTermLines = iPinnedLines;
+            iTermCols = iPinnedCols;
+        }
+
+        if (!bTermDirty && iTermLines == vtTerminal.cgScreen.iLines && iTermCols == vtTerminal.cgScreen.iCols)
+            return;
+        bTermDirty = false;
+
+        // only the latest screen is composited, the ones before it are skipped
+        uint32_t u32Screens = u32ScreensPending.exchange(0, std::memory_order_relaxed);
+        if (u32Screens > 1)
+            u64ScreensSkipped.fetch_add(u32Screens - 1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mtxTerminal);
+
+        CellGrid &cgTerm = vtTerminal.cgScreen;
+        if (iTermLines != cgTerm.iLines || iTermCols != cgTerm.iCols)
+        {
+            vtTerminal.Resize(iTermLines, iTermCols);
+
+            winsize ws{};
+            ws.ws_row = iTermLines;
+            ws.ws_col = iTermCols;
+            if (iMasterFd >= 0)
+                ioctl(iMasterFd, TIOCSWINSZ, &ws);
+            if (p_srRecorder != nullptr)
+                p_srRecorder->Resize(u32RecordPane, iTermLines, iTermCols);
+        }
+
+        // a pinned terminal smaller than the window leaves cells it no longer covers
+        if (bBlankMargins.exchange(false))
+        {
+            for (int y = iServerLine; y < cgBuffer.iLines; y++)
+                cgBuffer.FillRow(y, y - iServerLine < cgTerm.iLines ? cgTerm.iCols : 0, cgBuffer.iCols, ' ', 0, 0);
+        }
+
+        if (iViewOffset > 0 || iDrawnOffset > 0)
+        {
+            SyncHistoryView();
+            if (iDrawnOffset > 0)
+                return;
+        }
+
+        // put back the cell under the previous cursor
+        if (cgTerm.Contains(iCursorY, iCursorX) && iCursorY + iServerLine < cgBuffer.iLines)
+            CopyCell(iCursorY, iCursorX);
+
+        for (int y = 0; y < cgTerm.iLines && y + iServerLine < cgBuffer.iLines; y++)
+        {
+            if (!cgTerm.IsRowDirty(y))
+                continue;
+
+            cgTerm.ForEachDirty(y, [&](int x) {
+                if (x < cgBuffer.iCols)
+                    CopyCell(y, x);
+            });
+            cgTerm.ClearRowDirty(y);
+        }
+
+        iCursorY = vtTerminal.iCurY;
+        iCursorX = vtTerminal.iCurX;
+        if (vtTerminal.bCursorVisible && !bExited && iCursorY + iServerLine < cgBuffer.iLines &&
+            iCursorX < cgBuffer.iCols)
+        {
+            size_t i = cgTerm.Index(iCursorY, iCursorX);
+            cgBuffer.Set(iCursorY + iServerLine, iCursorX, cgTerm.vec_u32Glyphs[i], cgTerm.vec_u32Attrs[i] ^ A_REVERSE,
+                         cgTerm.vec_u32Colors[i]);
+        }
+    }
+
+  private:
+    std::atomic_bool bTermDirty{true};
+    std::atomic<uint32_t> u32ScreensPending{0}; // Feeds since the last Sync
+
+    // input handed to the shell, answered by whatever it writes next
+    std::atomic<int64_t> i64EchoInputNs{0};
+
+    // input for the pty from u_iOutputHead on, guarded by mtxOutput
+    std::mutex mtxOutput;
+    std::string strOutput;
+    size_t u_iOutputHead = 0;
+    bool bOutputBlocked = false;
+
+    // set by Record() before the pane is pumped
+    SessionRecorder *p_srRecorder = nullptr;
+    uint32_t u32RecordPane = 0;
+
+    // set by PinTerminal(), 0 while the terminal follows the window
+    std::atomic_int iPinnedLines{0}, iPinnedCols{0};
+    std::atomic_bool bBlankMargins{false};
+
+    // cursor cell as last drawn into cgBuffer
+    int iCursorX = -1, iCursorY = -1;
+
+    std::atomic_int iViewOffset{0};
+    int iDrawnOffset = 0;
+
+  private:
+    // The handler's input is answered by the shell's echo, not by a Flip
+    void AwaitEcho()
+    {
+        if (i64InputNs == 0)
+            return;
+
+        int64_t i64Expected = 0;
+        i64EchoInputNs.compare_exchange_strong(i64Expected, i64InputNs);
+        i64InputNs = 0;
+    }
+
+    // Write as much queued input as the pty takes in large writes; tells the
+    // watcher when it starts or stops having to wait for POLLOUT
+    void FlushOutputLocked()
+    {
+        u_iOutputHead += WriteLocked(strOutput.data() + u_iOutputHead, strOutput.size() - u_iOutputHead);
+
+        if (u_iOutputHead == strOutput.size())
+        {
+            strOutput.clear();
+            u_iOutputHead = 0;
+        }
+        else if (u_iOutputHead > strOutput.size() / 2)
+        {
+            strOutput.erase(0, u_iOutputHead);
+            u_iOutputHead = 0;
+        }
+
+        bool bBlocked = !strOutput.empty();
+        if (bBlocked != bOutputBlocked)
+        {
+            bOutputBlocked = bBlocked;
+            if (fnOutputBlocked)
+                fnOutputBlocked(bBlocked);
+        }
+    }
+
+    // How much of the bytes the pty took; all of them when there is no pty
+    // to take them any more, as they are dropped
+    size_t WriteLocked(const char *c_p_chData, size_t u_iSize)
+    {
+        if (iMasterFd < 0 || bExited)
+            return u_iSize;
+
+        size_t u_iWritten = 0;
+        while (u_iWritten < u_iSize)
+        {
+            ssize_t n = write(iMasterFd, c_p_chData + u_iWritten, u_iSize - u_iWritten);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n <= 0)
+                return u_iSize; // gone, drop it
+            u_iWritten += n;
+        }
+        return u_iWritten;
+    }
+
+    void Spawn(const char *c_strShell)
+    {
+        if (c_strShell == nullptr)
+            c_strShell = getenv("SHELL");
+        if (c_strShell == nullptr || *c_strShell == '\0')
+            c_strShell = "/bin/sh";
+
+        winsize ws{};
+        ws.ws_row = vtTerminal.cgScreen.iLines;
+        ws.ws_col = vtTerminal.cgScreen.iCols;
+
+        pidShell = forkpty(&iMasterFd, nullptr, nullptr, &ws);
+        if (pidShell < 0)
+        {
+            iMasterFd = -1;
+            return;
+        }
+
+        if (pidShell == 0)
+        {
+            // the parent blocks signals it reads through signalfd
+            sigset_t sigs;
+            sigemptyset(&sigs);
+            sigprocmask(SIG_SETMASK, &sigs, nullptr);
+
+            setenv("TERM", "xterm-256color", 1);
+            unsetenv("LINES");
+            unsetenv("COLUMNS");
+            execlp(c_strShell, c_strShell, (char *)nullptr);
+            _exit(127);
+        }
+
+        fcntl(iMasterFd, F_SETFL, fcntl(iMasterFd, F_GETFL) | O_NONBLOCK);
+        fcntl(iMasterFd, F_SETFD, FD_CLOEXEC);
+    }
+
+    // Redraw the whole pane with the view iViewOffset lines into history
+    void SyncHistoryView()
+    {
+        CellGrid &cgTerm = vtTerminal.cgScreen;
+        long lHistory = static_cast<long>(sbHistory.Lines());
+        int iOffset = static_cast<int>(std::min<long>(iViewOffset, lHistory));
+        iViewOffset = iOffset;
+
+        for (int y = 0; y < cgTerm.iLines && y + iServerLine < cgBuffer.iLines; y++)
+        {
+            if (y < iOffset)
+            {
+                sbHistory.ReadLine(lHistory - iOffset + y, cgBuffer, y + iServerLine);
+            }
+            else
+            {
+                for (int x = 0; x < cgTerm.iCols && x < cgBuffer.iCols; x++)
+                    CopyCell(y - iOffset, x, y);
+            }
+        }
+
+        cgTerm.ClearDirty();
+        iDrawnOffset = iOffset;
+        iCursorX = iCursorY = -1;
+    }
+
+    // copy terminal cell (y, x) to pane row iRow, by default the same row
+    void CopyCell(int y, int x, int iRow = -1)
+    {
+        const CellGrid &cgTerm = vtTerminal.cgScreen;
+        size_t i = cgTerm.Index(y, x);
+        cgBuffer.Set((iRow < 0 ? y : iRow) + iServerLine, x, cgTerm.vec_u32Glyphs[i], cgTerm.vec_u32Attrs[i], cgTerm.vec_u32Colors[i]);
+    }
+};
+
+// Panes that take the same input. Keys typed into a member are gathered in
+// one buffer, and once per frame Flush writes that buffer to every member's
+// pty: a burst of keys costs each pane one write, not one message per key.
+// Pastes share the one refcounted WM_PASTE text among the members. Used on
+// the thread that reads input.
+class ShellSyncGroup
+{
+  public:
+    // Add or remove p_wndPane; returns whether it is a member now
+    bool Toggle(ShellWindow *p_wndPane)
+    {
+        auto it = std::find(vec_p_wndPanes.begin(), vec_p_wndPanes.end(), p_wndPane);
+        if (it != vec_p_wndPanes.end())
+        {
+            vec_p_wndPanes.erase(it);
+            return false;
+        }
+        vec_p_wndPanes.push_back(p_wndPane);
+        return true;
+    }
+
+    bool Contains(const AWindow *p_wndWindow) const
+    {
+        return std::find(vec_p_wndPanes.begin(), vec_p_wndPanes.end(), p_wndWindow) != vec_p_wndPanes.end();
+    }
+
+    // Queue a key typed into p_wndFrom, encoded in its cursor key mode;
+    // false for keys the members should not share, like scrolling
+    bool AddKey(ShellWindow *p_wndFrom, int key)
+    {
+        if (key == KEY_SPREVIOUS || key == KEY_SNEXT)
+            return false;
+        return ShellWindow::KeySequence(key, p_wndFrom->vtTerminal.bAppCursor, &strPending);
+    }
+
+    // Every member gets the same text, each pastes it in its own mode
+    void AddPaste(const std::shared_ptr<const std::string> &p_strText)
+    {
+        Flush(); // after the keys typed before it
+        for (ShellWindow *p_wndPane : vec_p_wndPanes)
+            p_wndPane->PushMessage(Msg{WM_PASTE, p_strText});
+    }
+
+    bool Pending() const
+    {
+        return !strPending.empty();
+    }
+
+    void Flush()
+    {
+        if (strPending.empty())
+            return;
+        for (ShellWindow *p_wndPane : vec_p_wndPanes)
+            p_wndPane->SendSynced(strPending);
+        strPending.clear();
+    }
+
+  private:
+    std::vector<ShellWindow *> vec_p_wndPanes;
+    std::string strPending;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define SLOT_INDEX_BITS 16
+#define SLOT_INDEX_MASK ((1u << SLOT_INDEX_BITS) - 1)
+#define SLOT_HANDLE_NONE 0u
+
+// Values addressed by 32-bit generational handles: the low SLOT_INDEX_BITS
+// pick a slot, the rest is the slot's generation, bumped on every erase so
+// an old handle stops resolving. Values live packed in a dense array for
+// iteration; erasing moves the last one into the hole. Handle 0 is never
+// issued. A slot reused 65535 times wraps its generation.
+template <typename T>
+class SlotMap
+{
+  public:
+    typedef uint32_t handle;
+
+    handle Insert(T tValue)
+    {
+        uint32_t u32Slot;
+        if (u32FreeHead != SLOT_INDEX_MASK)
+        {
+            u32Slot = u32FreeHead;
+            u32FreeHead = vec_slSlots[u32Slot].u32Index;
+        }
+        else
+        {
+            if (vec_slSlots.size() >= SLOT_INDEX_MASK)
+                return SLOT_HANDLE_NONE;
+            u32Slot = static_cast<uint32_t>(vec_slSlots.size());
+            vec_slSlots.push_back(Slot{1, 0});
+        }
+
+        Slot &sl = vec_slSlots[u32Slot];
+        sl.u32Index = static_cast<uint32_t>(vec_tValues.size());
+        vec_tValues.push_back(std::move(tValue));
+        vec_u32ValueSlots.push_back(u32Slot);
+        return MakeHandle(u32Slot, sl.u32Generation);
+    }
+
+    bool Erase(handle hValue)
+    {
+        Slot *p_sl = Resolve(hValue);
+        if (p_sl == nullptr)
+            return false;
+
+        // move the last value into the hole and repoint its slot
+        uint32_t u32Index = p_sl->u32Index;
+        uint32_t u32Last = static_cast<uint32_t>(vec_tValues.size() - 1);
+        if (u32Index != u32Last)
+        {
+            vec_tValues[u32Index] = std::move(vec_tValues[u32Last]);
+            vec_u32ValueSlots[u32Index] = vec_u32ValueSlots[u32Last];
+            vec_slSlots[vec_u32ValueSlots[u32Index]].u32Index = u32Index;
+        }
+        vec_tValues.pop_back();
+        vec_u32ValueSlots.pop_back();
+
+        uint32_t u32Slot = hValue & SLOT_INDEX_MASK;
+        p_sl->u32Generation = p_sl->u32Generation == MaxGeneration() ? 1 : p_sl->u32Generation + 1;
+        p_sl->u32Index = u32FreeHead;
+        u32FreeHead = u32Slot;
+        return true;
+    }
+
+    // nullptr when hValue was erased or never issued
+    T *Get(handle hValue)
+    {
+        Slot *p_sl = Resolve(hValue);
+        return p_sl != nullptr ? &vec_tValues[p_sl->u32Index] : nullptr;
+    }
+
+    bool Contains(handle hValue)
+    {
+        return Resolve(hValue) != nullptr;
+    }
+
+    // handle of the value at a dense position, for iteration
+    handle HandleAt(size_t i) const
+    {
+        uint32_t u32Slot = vec_u32ValueSlots[i];
+        return MakeHandle(u32Slot, vec_slSlots[u32Slot].u32Generation);
+    }
+
+    size_t Size() const
+    {
+        return vec_tValues.size();
+    }
+
+    bool Empty() const
+    {
+        return vec_tValues.empty();
+    }
+
+    // dense values, in no particular order
+    typename std::vector<T>::iterator begin()
+    {
+        return vec_tValues.begin();
+    }
+
+    typename std::vector<T>::iterator end()
+    {
+        return vec_tValues.end();
+    }
+
+  private:
+    struct Slot
+    {
+        uint32_t u32Generation;
+        uint32_t u32Index; // into vec_tValues, or the next free slot
+    };
+
+    std::vector<T> vec_tValues;
+    std::vector<uint32_t> vec_u32ValueSlots;
+    std::vector<Slot> vec_slSlots;
+    uint32_t u32FreeHead = SLOT_INDEX_MASK;
+
+  private:
+    static constexpr uint32_t MaxGeneration()
+    {
+        return (1u << (32 - SLOT_INDEX_BITS)) - 1;
+    }
+
+    static handle MakeHandle(uint32_t u32Slot, uint32_t u32Generation)
+    {
+        return (u32Generation << SLOT_INDEX_BITS) | u32Slot;
+    }
+
+    Slot *Resolve(handle hValue)
+    {
+        uint32_t u32Slot = hValue & SLOT_INDEX_MASK;
+        if (hValue == SLOT_HANDLE_NONE || u32Slot >= vec_slSlots.size())
+            return nullptr;
+
+        Slot &sl = vec_slSlots[u32Slot];
+        if (sl.u32Generation != hValue >> SLOT_INDEX_BITS)
+            return nullptr;
+        return &sl;
+    }
+};
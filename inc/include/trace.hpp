@@ -0,0 +1,167 @@
+#pragma once
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_RING_EVENTS 16384
+
+// Span recorder for chrome://tracing and Perfetto. Every thread appends
+// complete events to its own ring, so recording takes no lock; Write()
+// copies the rings out and emits Chrome trace JSON. Disabled it costs one
+// relaxed load per span.
+class Tracer
+{
+  public:
+    struct Event
+    {
+        const char *c_strName; // must outlive the tracer, usually a literal
+        const char *c_strCategory;
+        int64_t i64StartNs;
+        int64_t i64DurationNs;
+    };
+
+    static void Enable(const char *c_strPath)
+    {
+        strPath = c_strPath;
+        bEnabled = true;
+    }
+
+    static bool Enabled()
+    {
+        return bEnabled.load(std::memory_order_relaxed);
+    }
+
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static void Record(const char *c_strName, const char *c_strCategory, int64_t i64StartNs, int64_t i64EndNs)
+    {
+        Ring *p_rngRing = LocalRing();
+        uint64_t u64Head = p_rngRing->u64Head.load(std::memory_order_relaxed);
+        p_rngRing->arr_evEvents[u64Head % TRACE_RING_EVENTS] = Event{c_strName, c_strCategory, i64StartNs, i64EndNs - i64StartNs};
+        p_rngRing->u64Head.store(u64Head + 1, std::memory_order_release);
+    }
+
+    // Dump what the rings hold; safe while other threads keep recording
+    static bool Write()
+    {
+        if (!Enabled())
+            return false;
+
+        FILE *p_fOut = fopen(strPath.c_str(), "w");
+        if (p_fOut == nullptr)
+            return false;
+
+        std::vector<Ring *> vec_p_rngRings;
+        {
+            std::lock_guard<std::mutex> lock(mtxRings);
+            for (std::unique_ptr<Ring> &p_rngRing : vec_p_rngAllRings)
+                vec_p_rngRings.push_back(p_rngRing.get());
+        }
+
+        fputs("{\"traceEvents\":[\n", p_fOut);
+        bool bFirst = true;
+        for (Ring *p_rngRing : vec_p_rngRings)
+        {
+            fprintf(p_fOut, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    bFirst ? "" : ",\n", p_rngRing->iTid, p_rngRing->arr_chName);
+            bFirst = false;
+
+            // the writer may lap the oldest entries while they are copied,
+            // so leave a margin behind it and drop anything it overtook
+            uint64_t u64Head = p_rngRing->u64Head.load(std::memory_order_acquire);
+            uint64_t u64Tail = u64Head > TRACE_RING_EVENTS / 2 ? u64Head - TRACE_RING_EVENTS / 2 : 0;
+            std::vector<Event> vec_evEvents;
+            for (uint64_t u64 = u64Tail; u64 < u64Head; u64++)
+                vec_evEvents.push_back(p_rngRing->arr_evEvents[u64 % TRACE_RING_EVENTS]);
+            uint64_t u64Lapped = p_rngRing->u64Head.load(std::memory_order_acquire) + 1;
+            size_t u_iSkip = u64Lapped > u64Tail + TRACE_RING_EVENTS ? u64Lapped - u64Tail - TRACE_RING_EVENTS : 0;
+
+            for (size_t i = u_iSkip; i < vec_evEvents.size(); i++)
+            {
+                const Event &ev = vec_evEvents[i];
+                fprintf(p_fOut,
+                        ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        ev.c_strName, ev.c_strCategory, p_rngRing->iTid, ev.i64StartNs / 1000.0,
+                        ev.i64DurationNs / 1000.0);
+            }
+        }
+        fputs("\n]}\n", p_fOut);
+        return fclose(p_fOut) == 0;
+    }
+
+  private:
+    struct Ring
+    {
+        std::atomic<uint64_t> u64Head{0};
+        int iTid = 0;
+        char arr_chName[16] = {};
+        Event arr_evEvents[TRACE_RING_EVENTS];
+    };
+
+    static inline std::atomic_bool bEnabled{false};
+    static inline std::string strPath;
+    static inline std::mutex mtxRings;
+    static inline std::vector<std::unique_ptr<Ring>> vec_p_rngAllRings;
+    static inline thread_local Ring *t_p_rngRing = nullptr;
+
+  private:
+    // rings are never freed, a thread's events outlive the thread
+    static Ring *LocalRing()
+    {
+        if (t_p_rngRing != nullptr)
+            return t_p_rngRing;
+
+        Ring *p_rngRing = new Ring;
+        p_rngRing->iTid = static_cast<int>(syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), p_rngRing->arr_chName, sizeof(p_rngRing->arr_chName));
+
+        std::lock_guard<std::mutex> lock(mtxRings);
+        vec_p_rngAllRings.emplace_back(p_rngRing);
+        t_p_rngRing = p_rngRing;
+        return p_rngRing;
+    }
+};
+
+// Records the enclosing scope as one span when tracing is on
+class TraceSpan
+{
+  public:
+    TraceSpan(const char *c_strName, const char *c_strCategory)
+        : c_strName(c_strName), c_strCategory(c_strCategory), i64StartNs(Tracer::Enabled() ? Tracer::NowNs() : 0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (i64StartNs != 0)
+            Tracer::Record(c_strName, c_strCategory, i64StartNs, Tracer::NowNs());
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+  private:
+    const char *c_strName;
+    const char *c_strCategory;
+    int64_t i64StartNs;
+};
+
+// Lock mtx, recording the time spent waiting for it as a "lock" span
+template <typename MutexT>
+void TracedLock(MutexT &mtx, const char *c_strName)
+{
+    TraceSpan tsWait(c_strName, "lock");
+    mtx.lock();
+}
@@ -1,11 +1,12 @@
 #pragma once
 #include <limits>
-#include <queue>
+#include <algorithm>
 #include <mutex>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <cstdint>
 
 //#define NULL_PTR reinterpret_cast<void*>(0)
 #define NULL_PTR \
@@ -23,6 +24,57 @@ typedef struct tagRect
 
 } Rect;
 
+// Rects are half-open: right and bottom are exclusive
+inline bool RectEmpty(const Rect &rc)
+{
+    return rc.left >= rc.right || rc.top >= rc.bottom;
+}
+
+inline Rect RectIntersect(const Rect &rcA, const Rect &rcB)
+{
+    return Rect{std::max(rcA.left, rcB.left), std::max(rcA.top, rcB.top),
+                std::min(rcA.right, rcB.right), std::min(rcA.bottom, rcB.bottom)};
+}
+
+inline Rect RectUnion(const Rect &rcA, const Rect &rcB)
+{
+    if (RectEmpty(rcA))
+        return rcB;
+    if (RectEmpty(rcB))
+        return rcA;
+
+    return Rect{std::min(rcA.left, rcB.left), std::min(rcA.top, rcB.top),
+                std::max(rcA.right, rcB.right), std::max(rcA.bottom, rcB.bottom)};
+}
+
+// overlapping or edge-adjacent
+inline bool RectTouches(const Rect &rcA, const Rect &rcB)
+{
+    return rcA.left <= rcB.right && rcB.left <= rcA.right && rcA.top <= rcB.bottom && rcB.top <= rcA.bottom;
+}
+
+// Split what of rcA lies outside rcB into at most 4 disjoint rects; returns how many
+inline int RectSubtract(const Rect &rcA, const Rect &rcB, Rect arr_rcOut[4])
+{
+    Rect rcCut = RectIntersect(rcA, rcB);
+    if (RectEmpty(rcCut))
+    {
+        arr_rcOut[0] = rcA;
+        return 1;
+    }
+
+    int iCount = 0;
+    if (rcA.top < rcCut.top)
+        arr_rcOut[iCount++] = Rect{rcA.left, rcA.top, rcA.right, rcCut.top};
+    if (rcCut.bottom < rcA.bottom)
+        arr_rcOut[iCount++] = Rect{rcA.left, rcCut.bottom, rcA.right, rcA.bottom};
+    if (rcA.left < rcCut.left)
+        arr_rcOut[iCount++] = Rect{rcA.left, rcCut.top, rcCut.left, rcCut.bottom};
+    if (rcCut.right < rcA.right)
+        arr_rcOut[iCount++] = Rect{rcCut.right, rcCut.top, rcA.right, rcCut.bottom};
+    return iCount;
+}
+
 struct SharedMutex
 {
     std::mutex mtx;
@@ -224,54 +276,87 @@ struct StayInRange
     }
 };
 
-template <typename T>
-class BlockingQueue
+// Bounded lock-free multi-producer/single-consumer ring (per-slot sequence
+// numbers, after Vyukov). Producers never block and fail when the ring is
+// full. Capacity must be a power of two.
+template <typename T, size_t Capacity = 1024>
+class MpscQueue
 {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
   public:
-    void push(const T &value)
+    MpscQueue()
     {
+        for (size_t i = 0; i < Capacity; i++)
         {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_queue.push(value);
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
         }
-        m_condition.notify_one();
     }
 
-    T front()
+    // false when the ring is full
+    bool try_push(const T &value)
     {
-        return m_queue.front();
-    }
-
-    T pop()
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        while (m_queue.empty())
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
         {
-            m_condition.wait(lock);
+            Slot &slot = m_slots[pos & (Capacity - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
         }
-        T value = m_queue.front();
-        m_queue.pop();
-        return value;
+        return true;
     }
 
+    // consumer only
     bool peek(T *tRet, bool bNoRemove)
     {
-        if (m_queue.empty())
+        Slot &slot = m_slots[m_head & (Capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != m_head + 1)
             return false;
 
-        *tRet = m_queue.front();
-        if (!bNoRemove)
-            m_queue.pop();
+        if (bNoRemove)
+        {
+            *tRet = slot.value;
+            return true;
+        }
+
+        // moved out, so the ring holds no references to what it delivered
+        *tRet = std::move(slot.value);
+        slot.seq.store(m_head + Capacity, std::memory_order_release);
+        ++m_head;
         return true;
     }
 
-    bool empty()
+    bool empty() const
     {
-        return m_queue.empty();
+        return m_slots[m_head & (Capacity - 1)].seq.load(std::memory_order_acquire) != m_head + 1;
     }
 
   private:
-    std::queue<T> m_queue;
-    std::mutex m_mutex;
-    std::condition_variable m_condition;
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    alignas(64) std::atomic<size_t> m_tail{0};
+    alignas(64) size_t m_head = 0;
+    alignas(64) Slot m_slots[Capacity];
 };
@@ -0,0 +1,1001 @@
+#pragma once
+#include <ncurses.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VT_SCAN_X86 1
+#endif
+
+#include "cellgrid.hpp"
+#include "scrollback.hpp"
+
+#define VTS_GROUND 0
+#define VTS_ESCAPE 1
+#define VTS_ESCAPE_INTERMEDIATE 2
+#define VTS_CSI 3
+#define VTS_OSC 4
+#define VTS_STRING 5
+
+#define VT_MAX_PARAMS 16
+
+// Printable run scanners: return the first byte that is not printable ASCII
+// (a control, DEL or the start of a UTF-8 sequence), or end
+typedef const unsigned char *(*VtScanFn)(const unsigned char *, const unsigned char *);
+
+inline const unsigned char *VtScanScalar(const unsigned char *p, const unsigned char *end)
+{
+    while (p < end && *p >= 0x20 && *p < 0x7f)
+        ++p;
+    return p;
+}
+
+#ifdef VT_SCAN_X86
+// as signed bytes, controls and 0x80-0xff are both below 0x20
+inline const unsigned char *VtScanSse2(const unsigned char *p, const unsigned char *end)
+{
+    const __m128i c_v128Space = _mm_set1_epi8(0x20);
+    const __m128i c_v128Del = _mm_set1_epi8(0x7f);
+
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v128 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v128Special = _mm_or_si128(_mm_cmplt_epi8(v128, c_v128Space), _mm_cmpeq_epi8(v128, c_v128Del));
+        unsigned int u_iMask = _mm_movemask_epi8(v128Special);
+        if (u_iMask)
+            return p + __builtin_ctz(u_iMask);
+    }
+    return VtScanScalar(p, end);
+}
+
+__attribute__((target("avx2"))) inline const unsigned char *VtScanAvx2(const unsigned char *p,
+                                                                       const unsigned char *end)
+{
+    const __m256i c_v256Space = _mm256_set1_epi8(0x20);
+    const __m256i c_v256Del = _mm256_set1_epi8(0x7f);
+
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i v256 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i v256Special = _mm256_or_si256(_mm256_cmpgt_epi8(c_v256Space, v256), _mm256_cmpeq_epi8(v256, c_v256Del));
+        unsigned int u_iMask = _mm256_movemask_epi8(v256Special);
+        if (u_iMask)
+            return p + __builtin_ctz(u_iMask);
+    }
+    return VtScanSse2(p, end);
+}
+#endif
+
+inline VtScanFn VtSelectScan()
+{
+#ifdef VT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return VtScanAvx2;
+    if (__builtin_cpu_supports("sse2"))
+        return VtScanSse2;
+#endif
+    return VtScanScalar;
+}
+
+inline const VtScanFn c_fnVtScanPrintable = VtSelectScan();
+
+// VT100/xterm terminal model. Feed() runs the byte stream of a pty through
+// the escape sequence state machine and applies it to cgScreen.
+struct VtTerminal
+{
+    CellGrid cgScreen;
+    int iCurX = 0, iCurY = 0;
+    bool bWrapPending = false;
+    int iScrollTop = 0, iScrollBottom = 0; // [top, bottom)
+
+    uint32_t u32Attr = 0;
+    uint32_t u32Color = 0;
+
+    // modes; the two input modes are read by whoever encodes keys and
+    // pastes for the pty, without the lock the feeding thread holds
+    bool bAutoWrap = true;
+    std::atomic_bool bAppCursor{false};
+    bool bCursorVisible = true;
+    std::atomic_bool bBracketedPaste{false};
+    bool bInsertMode = false;
+    bool bOriginMode = false;
+    bool bAltScreen = false;
+
+    // bytes the terminal answers with (DSR, DA), to be written back to the pty
+    std::string strReply;
+    std::string strTitle;
+    bool bTitleChanged = false;
+
+    // receives lines scrolled off the top of the primary screen
+    Scrollback *p_sbHistory = nullptr;
+
+    VtTerminal(int lines, int cols)
+    {
+        Resize(lines, cols);
+    }
+
+    void Resize(int lines, int cols)
+    {
+        lines = std::max(lines, 1);
+        cols = std::max(cols, 1);
+
+        // keep the cursor line visible when the terminal gets shorter
+        if (cgScreen.iLines > 0 && iCurY >= lines)
+        {
+            int n = iCurY - lines + 1;
+            SaveHistory(0, n);
+            cgScreen.ScrollRows(0, cgScreen.iLines, n, ' ', 0, 0);
+            iCurY -= n;
+        }
+
+        cgScreen.Resize(lines, cols);
+        cgAltSaved.Resize(bAltScreen ? lines : 0, bAltScreen ? cols : 0);
+
+        iScrollTop = 0;
+        iScrollBottom = lines;
+        iCurY = std::min(iCurY, lines - 1);
+        iCurX = std::min(iCurX, cols - 1);
+        bWrapPending = false;
+    }
+
+    void Feed(const char *c_p_chData, size_t u_iSize)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(c_p_chData);
+        const unsigned char *end = p + u_iSize;
+
+        while (p < end)
+        {
+            // printable ASCII goes to the grid in runs, the state machine
+            // only sees controls, escape sequences and UTF-8
+            if (iState == VTS_GROUND && iUtf8Remaining == 0)
+            {
+                const unsigned char *q = c_fnVtScanPrintable(p, end);
+                if (q != p)
+                {
+                    PrintRun(p, q - p);
+                    p = q;
+                }
+                if (p == end)
+                    break;
+            }
+
+            Step(*p++);
+        }
+    }
+
+  private:
+    int iState = VTS_GROUND;
+
+    uint32_t u32Utf8 = 0;
+    int iUtf8Remaining = 0;
+
+    int arr_iParams[VT_MAX_PARAMS];
+    int iParamCount = 0;
+    bool bParamStarted = false;
+    char chPrivate = 0;
+    char chIntermediate = 0;
+    bool bStringEscape = false;
+    std::string strOsc;
+
+    bool bG0Graphics = false, bG1Graphics = false, bShiftOut = false;
+
+    int iSavedX = 0, iSavedY = 0;
+    uint32_t u32SavedAttr = 0, u32SavedColor = 0;
+    CellGrid cgAltSaved;
+
+  private:
+    uint32_t BlankColor() const
+    {
+        // erased cells take the current background, like xterm's bce
+        return u32Color & 0xffff0000;
+    }
+
+    void EraseCells(int y, int x0, int x1)
+    {
+        cgScreen.FillRow(y, x0, x1, ' ', 0, BlankColor());
+    }
+
+    void SaveHistory(int iTop, int n)
+    {
+        if (p_sbHistory == nullptr || bAltScreen || iTop != 0)
+            return;
+
+        for (int y = 0; y < n && y < cgScreen.iLines; y++)
+            p_sbHistory->Push(cgScreen, y);
+    }
+
+    void ScrollUp(int n)
+    {
+        SaveHistory(iScrollTop, std::min(n, iScrollBottom - iScrollTop));
+        cgScreen.ScrollRows(iScrollTop, iScrollBottom, n, ' ', 0, BlankColor());
+    }
+
+    void ScrollDown(int n)
+    {
+        cgScreen.ScrollRows(iScrollTop, iScrollBottom, -n, ' ', 0, BlankColor());
+    }
+
+    void LineFeed()
+    {
+        if (iCurY == iScrollBottom - 1)
+            ScrollUp(1);
+        else if (iCurY < cgScreen.iLines - 1)
+            ++iCurY;
+        bWrapPending = false;
+    }
+
+    void ReverseIndex()
+    {
+        if (iCurY == iScrollTop)
+            ScrollDown(1);
+        else if (iCurY > 0)
+            --iCurY;
+        bWrapPending = false;
+    }
+
+    void MoveCursor(int y, int x)
+    {
+        int iTop = bOriginMode ? iScrollTop : 0;
+        int iBottom = bOriginMode ? iScrollBottom : cgScreen.iLines;
+
+        iCurY = std::max(iTop, std::min(y, iBottom - 1));
+        iCurX = std::max(0, std::min(x, cgScreen.iCols - 1));
+        bWrapPending = false;
+    }
+
+    void Print(uint32_t u32Glyph)
+    {
+        if (bWrapPending)
+        {
+            if (bAutoWrap)
+            {
+                iCurX = 0;
+                LineFeed();
+            }
+            bWrapPending = false;
+        }
+
+        if (bInsertMode)
+            cgScreen.ShiftCells(iCurY, iCurX, 1, ' ', 0, BlankColor());
+
+        cgScreen.Set(iCurY, iCurX, u32Glyph, u32Attr, u32Color);
+
+        if (iCurX == cgScreen.iCols - 1)
+            bWrapPending = true;
+        else
+            ++iCurX;
+    }
+
+    void PrintRun(const unsigned char *p, size_t u_iCount)
+    {
+        if (bInsertMode || (bShiftOut ? bG1Graphics : bG0Graphics))
+        {
+            for (; u_iCount > 0; --u_iCount)
+                Print(MapCharset(*p++));
+            return;
+        }
+
+        while (u_iCount > 0)
+        {
+            if (bWrapPending)
+            {
+                if (bAutoWrap)
+                {
+                    iCurX = 0;
+                    LineFeed();
+                }
+                else
+                {
+                    // without autowrap the run keeps overwriting the last column
+                    p += u_iCount - 1;
+                    u_iCount = 1;
+                    iCurX = cgScreen.iCols - 1;
+                }
+                bWrapPending = false;
+            }
+
+            int n = static_cast<int>(std::min<size_t>(u_iCount, cgScreen.iCols - iCurX));
+            cgScreen.SetRun(iCurY, iCurX, p, n, u32Attr, u32Color);
+            p += n;
+            u_iCount -= n;
+
+            iCurX += n;
+            if (iCurX >= cgScreen.iCols)
+            {
+                iCurX = cgScreen.iCols - 1;
+                bWrapPending = true;
+            }
+        }
+    }
+
+    uint32_t MapCharset(unsigned char chCh) const
+    {
+        // DEC special graphics, 0x60-0x7e
+        static const uint16_t c_arrDecGraphics[] = {0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0, 0x00b1,
+                                                    0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c, 0x23ba,
+                                                    0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534, 0x252c,
+                                                    0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7};
+
+        bool bGraphics = bShiftOut ? bG1Graphics : bG0Graphics;
+        if (bGraphics && chCh >= 0x60 && chCh <= 0x7e)
+            return c_arrDecGraphics[chCh - 0x60];
+        return chCh;
+    }
+
+    void Execute(unsigned char chCh)
+    {
+        switch (chCh)
+        {
+        case '\a':
+            break;
+        case '\b':
+            if (iCurX > 0)
+                --iCurX;
+            bWrapPending = false;
+            break;
+        case '\t':
+            iCurX = std::min((iCurX / 8 + 1) * 8, cgScreen.iCols - 1);
+            bWrapPending = false;
+            break;
+        case '\n':
+        case '\v':
+        case '\f':
+            LineFeed();
+            break;
+        case '\r':
+            iCurX = 0;
+            bWrapPending = false;
+            break;
+        case 0x0e:
+            bShiftOut = true;
+            break;
+        case 0x0f:
+            bShiftOut = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Step(unsigned char chCh)
+    {
+        // CAN and SUB abort any sequence, ESC restarts one
+        if (chCh == 0x18 || chCh == 0x1a)
+        {
+            iState = VTS_GROUND;
+            return;
+        }
+        if (chCh == 0x1b)
+        {
+            if (iState == VTS_OSC || iState == VTS_STRING)
+            {
+                bStringEscape = true;
+                return;
+            }
+            EnterEscape();
+            return;
+        }
+
+        switch (iState)
+        {
+        case VTS_GROUND:
+            GroundByte(chCh);
+            break;
+
+        case VTS_ESCAPE:
+            if (chCh < 0x20)
+                Execute(chCh);
+            else if (chCh < 0x30)
+            {
+                chIntermediate = chCh;
+                iState = VTS_ESCAPE_INTERMEDIATE;
+            }
+            else
+                EscapeDispatch(chCh);
+            break;
+
+        case VTS_ESCAPE_INTERMEDIATE:
+            if (chCh < 0x20)
+                Execute(chCh);
+            else if (chCh >= 0x30)
+            {
+                if (chIntermediate == '(')
+                    bG0Graphics = chCh == '0';
+                else if (chIntermediate == ')')
+                    bG1Graphics = chCh == '0';
+                iState = VTS_GROUND;
+            }
+            break;
+
+        case VTS_CSI:
+            CsiByte(chCh);
+            break;
+
+        case VTS_OSC:
+            if (bStringEscape || chCh == '\a')
+            {
+                // ESC \ or BEL ends the string
+                OscDispatch();
+                bStringEscape = false;
+                iState = VTS_GROUND;
+            }
+            else if (strOsc.size() < 4096)
+                strOsc += static_cast<char>(chCh);
+            break;
+
+        case VTS_STRING:
+            if (bStringEscape || chCh == '\a')
+            {
+                bStringEscape = false;
+                iState = VTS_GROUND;
+            }
+            break;
+        }
+    }
+
+    void EnterEscape()
+    {
+        iState = VTS_ESCAPE;
+        chIntermediate = 0;
+        iUtf8Remaining = 0;
+    }
+
+    void GroundByte(unsigned char chCh)
+    {
+        if (iUtf8Remaining > 0)
+        {
+            if ((chCh & 0xc0) == 0x80)
+            {
+                u32Utf8 = (u32Utf8 << 6) | (chCh & 0x3f);
+                if (--iUtf8Remaining == 0)
+                    Print(u32Utf8);
+                return;
+            }
+
+            // broken sequence, show a replacement and reprocess this byte
+            iUtf8Remaining = 0;
+            Print(0xfffd);
+        }
+
+        if (chCh < 0x20 || chCh == 0x7f)
+        {
+            Execute(chCh);
+        }
+        else if (chCh < 0x80)
+        {
+            Print(MapCharset(chCh));
+        }
+        else if ((chCh & 0xe0) == 0xc0)
+        {
+            u32Utf8 = chCh & 0x1f;
+            iUtf8Remaining = 1;
+        }
+        else if ((chCh & 0xf0) == 0xe0)
+        {
+            u32Utf8 = chCh & 0x0f;
+            iUtf8Remaining = 2;
+        }
+        else if ((chCh & 0xf8) == 0xf0)
+        {
+            u32Utf8 = chCh & 0x07;
+            iUtf8Remaining = 3;
+        }
+        else
+        {
+            Print(0xfffd);
+        }
+    }
+
+    void EscapeDispatch(unsigned char chCh)
+    {
+        iState = VTS_GROUND;
+
+        switch (chCh)
+        {
+        case '[':
+            iState = VTS_CSI;
+            iParamCount = 0;
+            bParamStarted = false;
+            chPrivate = 0;
+            chIntermediate = 0;
+            arr_iParams[0] = 0;
+            break;
+        case ']':
+            iState = VTS_OSC;
+            strOsc.clear();
+            bStringEscape = false;
+            break;
+        case 'P':
+        case 'X':
+        case '^':
+        case '_':
+            iState = VTS_STRING;
+            bStringEscape = false;
+            break;
+        case '7':
+            SaveCursor();
+            break;
+        case '8':
+            RestoreCursor();
+            break;
+        case 'D':
+            LineFeed();
+            break;
+        case 'E':
+            iCurX = 0;
+            LineFeed();
+            break;
+        case 'M':
+            ReverseIndex();
+            break;
+        case 'c':
+            Reset();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void CsiByte(unsigned char chCh)
+    {
+        if (chCh < 0x20)
+        {
+            Execute(chCh);
+        }
+        else if (chCh >= '0' && chCh <= '9')
+        {
+            if (iParamCount < VT_MAX_PARAMS)
+            {
+                if (!bParamStarted)
+                {
+                    arr_iParams[iParamCount] = 0;
+                    bParamStarted = true;
+                }
+                arr_iParams[iParamCount] = std::min(arr_iParams[iParamCount] * 10 + (chCh - '0'), 65535);
+            }
+        }
+        else if (chCh == ';' || chCh == ':')
+        {
+            if (!bParamStarted && iParamCount < VT_MAX_PARAMS)
+                arr_iParams[iParamCount] = 0;
+            if (iParamCount < VT_MAX_PARAMS)
+                ++iParamCount;
+            bParamStarted = false;
+        }
+        else if (chCh >= 0x3c && chCh <= 0x3f)
+        {
+            chPrivate = chCh;
+        }
+        else if (chCh >= 0x20 && chCh < 0x30)
+        {
+            chIntermediate = chCh;
+        }
+        else if (chCh >= 0x40 && chCh <= 0x7e)
+        {
+            if (bParamStarted && iParamCount < VT_MAX_PARAMS)
+                ++iParamCount;
+            iState = VTS_GROUND;
+            CsiDispatch(chCh);
+        }
+    }
+
+    int Param(int i, int iDefault) const
+    {
+        if (i >= iParamCount || arr_iParams[i] == 0)
+            return iDefault;
+        return arr_iParams[i];
+    }
+
+    void CsiDispatch(unsigned char chFinal)
+    {
+        int iLines = cgScreen.iLines, iCols = cgScreen.iCols;
+
+        if (chIntermediate != 0)
+        {
+            // DECSTR soft reset; DECSCUSR and friends are ignored
+            if (chIntermediate == '!' && chFinal == 'p')
+                SoftReset();
+            return;
+        }
+
+        if (chPrivate == '?')
+        {
+            if (chFinal == 'h' || chFinal == 'l')
+            {
+                for (int i = 0; i < iParamCount; i++)
+                {
+                    SetPrivateMode(arr_iParams[i], chFinal == 'h');
+                }
+            }
+            return;
+        }
+
+        if (chPrivate == '>')
+        {
+            if (chFinal == 'c')
+                strReply += "\x1b[>0;0;0c";
+            return;
+        }
+
+        if (chPrivate != 0)
+            return;
+
+        switch (chFinal)
+        {
+        case '@':
+            cgScreen.ShiftCells(iCurY, iCurX, Param(0, 1), ' ', 0, BlankColor());
+            break;
+        case 'A':
+            MoveCursor(std::max(iCurY - Param(0, 1), iCurY >= iScrollTop ? iScrollTop : 0), iCurX);
+            break;
+        case 'B':
+        case 'e':
+            MoveCursor(std::min(iCurY + Param(0, 1), iCurY < iScrollBottom ? iScrollBottom - 1 : iLines - 1), iCurX);
+            break;
+        case 'C':
+        case 'a':
+            MoveCursor(iCurY, iCurX + Param(0, 1));
+            break;
+        case 'D':
+            MoveCursor(iCurY, iCurX - Param(0, 1));
+            break;
+        case 'E':
+            MoveCursor(iCurY + Param(0, 1), 0);
+            break;
+        case 'F':
+            MoveCursor(iCurY - Param(0, 1), 0);
+            break;
+        case 'G':
+        case '`':
+            MoveCursor(iCurY, Param(0, 1) - 1);
+            break;
+        case 'H':
+        case 'f':
+            MoveCursor(Param(0, 1) - 1 + (bOriginMode ? iScrollTop : 0), Param(1, 1) - 1);
+            break;
+        case 'd':
+            MoveCursor(Param(0, 1) - 1 + (bOriginMode ? iScrollTop : 0), iCurX);
+            break;
+        case 'J':
+            switch (Param(0, 0))
+            {
+            case 0:
+                EraseCells(iCurY, iCurX, iCols);
+                for (int y = iCurY + 1; y < iLines; y++)
+                    EraseCells(y, 0, iCols);
+                break;
+            case 1:
+                for (int y = 0; y < iCurY; y++)
+                    EraseCells(y, 0, iCols);
+                EraseCells(iCurY, 0, iCurX + 1);
+                break;
+            case 3:
+                // saved lines only, the screen stays
+                if (p_sbHistory != nullptr)
+                    p_sbHistory->Clear();
+                break;
+            default:
+                for (int y = 0; y < iLines; y++)
+                    EraseCells(y, 0, iCols);
+                break;
+            }
+            bWrapPending = false;
+            break;
+        case 'K':
+            switch (Param(0, 0))
+            {
+            case 0:
+                EraseCells(iCurY, iCurX, iCols);
+                break;
+            case 1:
+                EraseCells(iCurY, 0, iCurX + 1);
+                break;
+            default:
+                EraseCells(iCurY, 0, iCols);
+                break;
+            }
+            bWrapPending = false;
+            break;
+        case 'L':
+            if (iCurY >= iScrollTop && iCurY < iScrollBottom)
+            {
+                cgScreen.ScrollRows(iCurY, iScrollBottom, -Param(0, 1), ' ', 0, BlankColor());
+                iCurX = 0;
+            }
+            break;
+        case 'M':
+            if (iCurY >= iScrollTop && iCurY < iScrollBottom)
+            {
+                cgScreen.ScrollRows(iCurY, iScrollBottom, Param(0, 1), ' ', 0, BlankColor());
+                iCurX = 0;
+            }
+            break;
+        case 'P':
+            cgScreen.ShiftCells(iCurY, iCurX, -Param(0, 1), ' ', 0, BlankColor());
+            bWrapPending = false;
+            break;
+        case 'S':
+            ScrollUp(Param(0, 1));
+            break;
+        case 'T':
+            ScrollDown(Param(0, 1));
+            break;
+        case 'X':
+            EraseCells(iCurY, iCurX, iCurX + Param(0, 1));
+            bWrapPending = false;
+            break;
+        case 'b':
+        {
+            uint32_t u32Last = iCurX > 0 ? cgScreen.vec_u32Glyphs[cgScreen.Index(iCurY, iCurX - 1)] : ' ';
+            for (int i = std::min(Param(0, 1), iLines * iCols); i > 0; i--)
+                Print(u32Last);
+            break;
+        }
+        case 'c':
+            strReply += "\x1b[?62;22c";
+            break;
+        case 'h':
+        case 'l':
+            for (int i = 0; i < iParamCount; i++)
+            {
+                if (arr_iParams[i] == 4)
+                    bInsertMode = chFinal == 'h';
+            }
+            break;
+        case 'm':
+            SelectGraphicRendition();
+            break;
+        case 'n':
+            if (Param(0, 0) == 5)
+            {
+                strReply += "\x1b[0n";
+            }
+            else if (Param(0, 0) == 6)
+            {
+                char buf[32];
+                int y = iCurY + 1 - (bOriginMode ? iScrollTop : 0);
+                strReply.append(buf, snprintf(buf, sizeof(buf), "\x1b[%d;%dR", y, iCurX + 1));
+            }
+            break;
+        case 'r':
+        {
+            int iTop = Param(0, 1) - 1, iBottom = Param(1, iLines);
+            if (iTop < iBottom - 1 && iBottom <= iLines)
+            {
+                iScrollTop = iTop;
+                iScrollBottom = iBottom;
+                MoveCursor(bOriginMode ? iScrollTop : 0, 0);
+            }
+            break;
+        }
+        case 's':
+            SaveCursor();
+            break;
+        case 'u':
+            RestoreCursor();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void SetPrivateMode(int iMode, bool bSet)
+    {
+        switch (iMode)
+        {
+        case 1:
+            bAppCursor = bSet;
+            break;
+        case 6:
+            bOriginMode = bSet;
+            MoveCursor(bOriginMode ? iScrollTop : 0, 0);
+            break;
+        case 7:
+            bAutoWrap = bSet;
+            break;
+        case 25:
+            bCursorVisible = bSet;
+            break;
+        case 47:
+        case 1047:
+        case 1049:
+            if (bSet == bAltScreen)
+                break;
+            if (bSet && iMode == 1049)
+                SaveCursor();
+            SwitchScreen(bSet);
+            if (!bSet && iMode == 1049)
+                RestoreCursor();
+            break;
+        case 2004:
+            bBracketedPaste = bSet;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // the primary screen is parked in cgAltSaved while the alternate one is shown
+    void SwitchScreen(bool bAlt)
+    {
+        if (bAlt)
+        {
+            cgAltSaved = cgScreen;
+            for (int y = 0; y < cgScreen.iLines; y++)
+                EraseCells(y, 0, cgScreen.iCols);
+        }
+        else
+        {
+            cgScreen = cgAltSaved;
+            cgAltSaved.Resize(0, 0);
+        }
+
+        cgScreen.MarkAllDirty();
+        bAltScreen = bAlt;
+    }
+
+    static int Nearest256(int r, int g, int b)
+    {
+        auto fnLevel = [](int v) { return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40; };
+        return 16 + 36 * fnLevel(r) + 6 * fnLevel(g) + fnLevel(b);
+    }
+
+    void SelectGraphicRendition()
+    {
+        int iFg = CellColorFg(u32Color), iBg = CellColorBg(u32Color);
+
+        if (iParamCount == 0)
+        {
+            u32Attr = 0;
+            u32Color = 0;
+            return;
+        }
+
+        for (int i = 0; i < iParamCount; i++)
+        {
+            int p = arr_iParams[i];
+            switch (p)
+            {
+            case 0:
+                u32Attr = 0;
+                iFg = iBg = -1;
+                break;
+            case 1:
+                u32Attr |= A_BOLD;
+                break;
+            case 2:
+                u32Attr |= A_DIM;
+                break;
+            case 3:
+                u32Attr |= A_ITALIC;
+                break;
+            case 4:
+                u32Attr |= A_UNDERLINE;
+                break;
+            case 5:
+            case 6:
+                u32Attr |= A_BLINK;
+                break;
+            case 7:
+                u32Attr |= A_REVERSE;
+                break;
+            case 8:
+                u32Attr |= A_INVIS;
+                break;
+            case 22:
+                u32Attr &= ~(A_BOLD | A_DIM);
+                break;
+            case 23:
+                u32Attr &= ~A_ITALIC;
+                break;
+            case 24:
+                u32Attr &= ~A_UNDERLINE;
+                break;
+            case 25:
+                u32Attr &= ~A_BLINK;
+                break;
+            case 27:
+                u32Attr &= ~A_REVERSE;
+                break;
+            case 28:
+                u32Attr &= ~A_INVIS;
+                break;
+            case 38:
+            case 48:
+            {
+                int iColor = -1;
+                if (i + 2 < iParamCount && arr_iParams[i + 1] == 5)
+                {
+                    iColor = arr_iParams[i + 2] & 0xff;
+                    i += 2;
+                }
+                else if (i + 4 < iParamCount && arr_iParams[i + 1] == 2)
+                {
+                    iColor = Nearest256(arr_iParams[i + 2], arr_iParams[i + 3], arr_iParams[i + 4]);
+                    i += 4;
+                }
+                else
+                {
+                    i = iParamCount;
+                    break;
+                }
+                (p == 38 ? iFg : iBg) = iColor;
+                break;
+            }
+            case 39:
+                iFg = -1;
+                break;
+            case 49:
+                iBg = -1;
+                break;
+            default:
+                if (p >= 30 && p <= 37)
+                    iFg = p - 30;
+                else if (p >= 40 && p <= 47)
+                    iBg = p - 40;
+                else if (p >= 90 && p <= 97)
+                    iFg = p - 90 + 8;
+                else if (p >= 100 && p <= 107)
+                    iBg = p - 100 + 8;
+                break;
+            }
+        }
+
+        u32Color = MakeCellColor(iFg, iBg);
+    }
+
+    void OscDispatch()
+    {
+        // 0 and 2 set the window title
+        if (strOsc.size() >= 2 && (strOsc[0] == '0' || strOsc[0] == '2') && strOsc[1] == ';')
+        {
+            strTitle = strOsc.substr(2);
+            bTitleChanged = true;
+        }
+    }
+
+    void SaveCursor()
+    {
+        iSavedX = iCurX;
+        iSavedY = iCurY;
+        u32SavedAttr = u32Attr;
+        u32SavedColor = u32Color;
+    }
+
+    void RestoreCursor()
+    {
+        u32Attr = u32SavedAttr;
+        u32Color = u32SavedColor;
+        MoveCursor(iSavedY, iSavedX);
+    }
+
+    void SoftReset()
+    {
+        u32Attr = 0;
+        u32Color = 0;
+        bAutoWrap = true;
+        bAppCursor = false;
+        bCursorVisible = true;
+        bInsertMode = false;
+        bOriginMode = false;
+        bG0Graphics = bG1Graphics = bShiftOut = false;
+        iScrollTop = 0;
+        iScrollBottom = cgScreen.iLines;
+    }
+
+    void Reset()
+    {
+        if (bAltScreen)
+            SwitchScreen(false);
+        SoftReset();
+        bBracketedPaste = false;
+        for (int y = 0; y < cgScreen.iLines; y++)
+            EraseCells(y, 0, cgScreen.iCols);
+        MoveCursor(0, 0);
+    }
+};
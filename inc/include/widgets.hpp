@@ -0,0 +1,246 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ncurses_custom.hpp"
+#include "format.hpp"
+
+// Retained widgets on top of an AWindow. Each widget remembers what it shows
+// and only records draw commands when that changes; because the window's
+// cell grid keeps everything drawn before, static text is recorded once and
+// a redraw costs as much as the values that moved.
+class Widget
+{
+  public:
+    int iY = 0, iX = 0;
+    chtype chtAttr = 0;
+
+    Widget(int y, int x) : iY(y), iX(x) {}
+    virtual ~Widget() {}
+
+    virtual void Invalidate()
+    {
+        bDirty = true;
+    }
+
+    bool IsDirty() const
+    {
+        return bDirty;
+    }
+
+    void Draw(AWindow *p_wndWindow)
+    {
+        if (chtAttr)
+            p_wndWindow->AttrOn(chtAttr);
+        Render(p_wndWindow);
+        if (chtAttr)
+            p_wndWindow->AttrOff(chtAttr);
+        bDirty = false;
+    }
+
+  protected:
+    bool bDirty = true;
+
+  protected:
+    virtual void Render(AWindow *p_wndWindow) = 0;
+
+    // text padded with blanks to iWidth, so a shorter value covers a longer one
+    static void PrintPadded(AWindow *p_wndWindow, int y, int x, std::string_view svText, int iWidth)
+    {
+        FormatBuffer fbText;
+        fbText.Append(svText.data(), std::min<size_t>(svText.size(), iWidth));
+        fbText.Fill(iWidth - fbText.u_iSize);
+        p_wndWindow->MVPrint<"{}">(y, x, std::string_view(fbText.arr_chData, fbText.u_iSize));
+    }
+};
+
+// Title row, same look as AWindow::Build
+class TitleBar : public Widget
+{
+  public:
+    TitleBar() : Widget(0, 0) {}
+
+  protected:
+    void Render(AWindow *p_wndWindow) override
+    {
+        std::string_view svTitle = p_wndWindow->c_p_strTitle;
+
+        p_wndWindow->AttrOn(p_wndWindow->i_title_attr);
+        p_wndWindow->Move(0, 0);
+        p_wndWindow->HLine(' ', p_wndWindow->iCols);
+        p_wndWindow->MVPrint<"{}">(0, std::max((p_wndWindow->iCols - static_cast<int>(svTitle.size())) / 2, 0), svTitle);
+        p_wndWindow->AttrOff(p_wndWindow->i_title_attr);
+    }
+};
+
+class Label : public Widget
+{
+  public:
+    Label(int y, int x, std::string strText) : Widget(y, x), strText(std::move(strText)) {}
+
+    void SetText(std::string_view svText)
+    {
+        if (svText == strText)
+            return;
+        strText = svText;
+        bDirty = true;
+    }
+
+  protected:
+    std::string strText;
+    int iShownWidth = 0;
+
+  protected:
+    void Render(AWindow *p_wndWindow) override
+    {
+        PrintPadded(p_wndWindow, iY, iX, strText, std::max(iShownWidth, static_cast<int>(strText.size())));
+        iShownWidth = static_cast<int>(strText.size());
+    }
+};
+
+// A value shown through a fixed format, e.g. ValueField<"{:.1f}", double>;
+// setting the value it already shows costs nothing
+template <FormatString Fmt, typename T>
+class ValueField : public Widget
+{
+  public:
+    // iWidth 0 sizes the field to the text, blanking what a longer value left
+    ValueField(int y, int x, int iWidth = 0) : Widget(y, x), iWidth(iWidth) {}
+
+    void Set(const T &tNewValue)
+    {
+        if (bHasValue && tNewValue == tValue)
+            return;
+        tValue = tNewValue;
+        bHasValue = true;
+        bDirty = true;
+    }
+
+  protected:
+    T tValue{};
+    bool bHasValue = false;
+    int iWidth;
+    int iShownWidth = 0;
+
+  protected:
+    void Render(AWindow *p_wndWindow) override
+    {
+        FormatBuffer fbText;
+        FormatTo<Fmt>(fbText, tValue);
+
+        int iLength = static_cast<int>(fbText.u_iSize);
+        int iPadTo = iWidth > 0 ? iWidth : std::max(iLength, iShownWidth);
+        PrintPadded(p_wndWindow, iY, iX, std::string_view(fbText.arr_chData, fbText.u_iSize), iPadTo);
+        iShownWidth = iLength;
+    }
+};
+
+// iRows lines of text of iWidth columns; only rows whose text changed are redrawn
+class List : public Widget
+{
+  public:
+    List(int y, int x, int iWidth, int iRows) : Widget(y, x), iWidth(iWidth), vec_strRows(iRows), vec_bRowDirty(iRows, true) {}
+
+    int Rows() const
+    {
+        return static_cast<int>(vec_strRows.size());
+    }
+
+    void SetRow(int i, std::string_view svText)
+    {
+        if (i < 0 || i >= Rows() || vec_strRows[i] == svText)
+            return;
+        vec_strRows[i] = svText;
+        vec_bRowDirty[i] = true;
+        bDirty = true;
+    }
+
+    void Invalidate() override
+    {
+        vec_bRowDirty.assign(vec_bRowDirty.size(), true);
+        bDirty = true;
+    }
+
+    // rows past the end of vec_strItems are blanked
+    void SetItems(const std::vector<std::string> &vec_strItems)
+    {
+        for (int i = 0; i < Rows(); i++)
+        {
+            SetRow(i, i < static_cast<int>(vec_strItems.size()) ? std::string_view(vec_strItems[i]) : std::string_view());
+        }
+    }
+
+  protected:
+    int iWidth;
+    std::vector<std::string> vec_strRows;
+    std::vector<bool> vec_bRowDirty;
+
+  protected:
+    void Render(AWindow *p_wndWindow) override
+    {
+        for (int i = 0; i < Rows(); i++)
+        {
+            if (!vec_bRowDirty[i])
+                continue;
+            PrintPadded(p_wndWindow, iY + i, iX, vec_strRows[i], iWidth);
+            vec_bRowDirty[i] = false;
+        }
+    }
+};
+
+// The widgets of one window, drawn by its handler
+class WidgetLayer
+{
+  public:
+    template <typename WidgetT, typename... Args>
+    WidgetT *Add(Args &&...args)
+    {
+        WidgetT *p_wgWidget = new WidgetT(std::forward<Args>(args)...);
+        vec_p_wgWidgets.emplace_back(p_wgWidget);
+        return p_wgWidget;
+    }
+
+    // drop every widget; the next Draw starts from a blank window
+    void Clear()
+    {
+        vec_p_wgWidgets.clear();
+        bErase = true;
+    }
+
+    // erase the window and render every widget on the next Draw
+    void Invalidate()
+    {
+        bErase = true;
+    }
+
+    // Record the widgets that changed into p_wndWindow; returns whether
+    // anything was recorded and the window needs a Flip
+    bool Draw(AWindow *p_wndWindow)
+    {
+        bool bDrawn = bErase;
+        if (bErase)
+        {
+            p_wndWindow->Erase();
+            for (std::unique_ptr<Widget> &p_wgWidget : vec_p_wgWidgets)
+                p_wgWidget->Invalidate();
+            bErase = false;
+        }
+
+        for (std::unique_ptr<Widget> &p_wgWidget : vec_p_wgWidgets)
+        {
+            if (!p_wgWidget->IsDirty())
+                continue;
+            p_wgWidget->Draw(p_wndWindow);
+            bDrawn = true;
+        }
+        return bDrawn;
+    }
+
+  private:
+    std::vector<std::unique_ptr<Widget>> vec_p_wgWidgets;
+    bool bErase = true;
+};
@@ -0,0 +1,370 @@
+#include <ncurses.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "ncurses_custom.hpp"
+#include "shell_window.hpp"
+#include "vtparser.hpp"
+#include "session_log.hpp"
+
+// Headless benchmark: WindowManager composes into a VtBackend that writes to
+// a pipe. The pipe is read back into a VtTerminal after every frame, so the
+// bytes are real terminal output and the final screen can be checked
+// against what was composed.
+
+#define BENCH_LINES 40
+#define BENCH_COLS 120
+#define BENCH_PIPE_SIZE (1 << 20)
+#define BENCH_FRAME_NS 16666667 // recorded time replayed per frame
+
+struct Bench
+{
+    WindowManager *p_wmgrWindows = nullptr;
+    VtBackend *p_vbBackend = nullptr;
+    VtTerminal vtReadback{BENCH_LINES, BENCH_COLS};
+    std::vector<std::unique_ptr<AWindow>> vec_p_wndWindows;
+
+    int iReadFd = -1;
+    char arr_chDrain[65536];
+
+    AWindow *Add(AWindow *p_wndWindow)
+    {
+        std::string strName = "bench" + std::to_string(vec_p_wndWindows.size());
+        vec_p_wndWindows.emplace_back(p_wndWindow);
+        p_wmgrWindows->Add(strName.c_str(), p_wndWindow);
+        return p_wndWindow;
+    }
+
+    void Resize(int lines, int cols)
+    {
+        resize_term(lines, cols);
+        vtReadback.Resize(lines, cols);
+        p_wmgrWindows->UpdateScreenSize();
+    }
+
+    void Drain()
+    {
+        ssize_t n;
+        while ((n = read(iReadFd, arr_chDrain, sizeof(arr_chDrain))) > 0)
+            vtReadback.Feed(arr_chDrain, n);
+    }
+
+    // cells the terminal shows that differ from the composed screen;
+    // line drawing is skipped, the terminal maps it to other code points
+    int Mismatches()
+    {
+        const CellGrid &cgScreen = *p_wmgrWindows->GetScreenGrid();
+        const CellGrid &cgTerm = vtReadback.cgScreen;
+        int iMismatches = 0;
+
+        for (int y = 0; y < cgScreen.iLines && y < cgTerm.iLines; y++)
+        {
+            for (int x = 0; x < cgScreen.iCols && x < cgTerm.iCols; x++)
+            {
+                size_t i = cgScreen.Index(y, x);
+                if (cgScreen.vec_u32Attrs[i] & A_ALTCHARSET)
+                    continue;
+
+                uint32_t u32Glyph = cgScreen.vec_u32Glyphs[i];
+                if (u32Glyph < 0x20 || u32Glyph == 0x7f)
+                    u32Glyph = ' ';
+                if (cgTerm.vec_u32Glyphs[cgTerm.Index(y, x)] != u32Glyph)
+                    ++iMismatches;
+            }
+        }
+        return iMismatches;
+    }
+};
+
+struct BenchResult
+{
+    std::vector<int64_t> vec_i64FrameNs;
+    uint64_t u64Bytes = 0;
+    uint64_t u64Writes = 0;
+    int iMismatches = 0;
+};
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static BenchResult RunWorkload(int iFrames, const std::function<void(Bench &)> &fnSetup,
+                               const std::function<void(Bench &, int)> &fnStep)
+{
+    int arr_iPipe[2];
+    if (pipe2(arr_iPipe, O_CLOEXEC) != 0)
+    {
+        perror("pipe2");
+        exit(1);
+    }
+    fcntl(arr_iPipe[0], F_SETPIPE_SZ, BENCH_PIPE_SIZE);
+    fcntl(arr_iPipe[0], F_SETFL, O_NONBLOCK);
+
+    resize_term(BENCH_LINES, BENCH_COLS);
+
+    Bench bench;
+    bench.iReadFd = arr_iPipe[0];
+    bench.p_wmgrWindows = new WindowManager{stdscr};
+    bench.p_vbBackend = new VtBackend{arr_iPipe[1]};
+    bench.p_wmgrWindows->SetBackend(bench.p_vbBackend);
+
+    fnSetup(bench);
+
+    BenchResult brResult;
+    for (int i = 0; i < iFrames; i++)
+    {
+        fnStep(bench, i);
+
+        int64_t i64Start = NowNs();
+        bench.p_wmgrWindows->PresentWindows();
+        bench.p_wmgrWindows->Flip();
+        brResult.vec_i64FrameNs.push_back(NowNs() - i64Start);
+
+        bench.Drain();
+    }
+
+    brResult.u64Bytes = bench.p_vbBackend->u64BytesWritten;
+    brResult.u64Writes = bench.p_vbBackend->u64Writes;
+    brResult.iMismatches = bench.Mismatches();
+
+    delete bench.p_wmgrWindows;
+    delete bench.p_vbBackend;
+    close(arr_iPipe[0]);
+    close(arr_iPipe[1]);
+    return brResult;
+}
+
+static void Report(const char *c_strName, BenchResult &brResult)
+{
+    std::vector<int64_t> &vec_i64Ns = brResult.vec_i64FrameNs;
+    std::sort(vec_i64Ns.begin(), vec_i64Ns.end());
+
+    auto fnPercentile = [&](double fRank) {
+        size_t i = std::min(vec_i64Ns.size() - 1, static_cast<size_t>(fRank * vec_i64Ns.size()));
+        return vec_i64Ns[i] / 1000.0;
+    };
+
+    double fFrames = static_cast<double>(vec_i64Ns.size());
+    printf("%-8s %6zu %9.1f %9.1f %9.1f %9.1f %12.0f %10.2f  %s\n", c_strName, vec_i64Ns.size(), fnPercentile(0.50),
+           fnPercentile(0.90), fnPercentile(0.99), vec_i64Ns.back() / 1000.0, brResult.u64Bytes / fFrames,
+           brResult.u64Writes / fFrames, brResult.iMismatches == 0 ? "ok" : "MISMATCH");
+}
+
+// One text-filled window, redrawn with iFrame in it
+static void DrawWindow(AWindow *p_wndWindow, int iFrame)
+{
+    p_wndWindow->Erase();
+    p_wndWindow->Build();
+    for (int y = 1; y < p_wndWindow->iLines; y++)
+    {
+        p_wndWindow->MVPrint<"frame {} row {}">(y, 1, iFrame, y);
+    }
+    p_wndWindow->Flip();
+}
+
+// Deterministic shell output: colored words, wrapped lines and scrolling
+static std::string FloodChunk(int iFrame, size_t u_iSize)
+{
+    std::string strOut;
+    char buf[128];
+    for (int i = 0; strOut.size() < u_iSize; i++)
+    {
+        int n = snprintf(buf, sizeof(buf), "\x1b[3%dm%06d\x1b[0m build/obj/unit_%d.o: compiled in %d ms\r\n", (iFrame + i) % 8,
+                         iFrame * 1000 + i, i, (iFrame * 7 + i * 13) % 997);
+        strOut.append(buf, n);
+    }
+    return strOut;
+}
+
+int main(int argc, char *argv[])
+{
+    int iFrames = 600;
+    const char *c_strReplay = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            iFrames = std::max(atoi(argv[++i]), 1);
+        // a recorded session (MultiShell --record) as an extra workload
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            c_strReplay = argv[++i];
+    }
+
+    // ncurses only supplies terminfo and color pairs here, its own output goes nowhere
+    FILE *p_fNull = fopen("/dev/null", "r+");
+    const char *c_strTerm = getenv("TERM");
+    SCREEN *p_scrScreen = newterm(c_strTerm != nullptr && *c_strTerm ? c_strTerm : "xterm-256color", p_fNull, p_fNull);
+    if (p_scrScreen == nullptr || !VtBackend::Supported())
+    {
+        fprintf(stderr, "bench: terminal type has no ANSI cursor addressing\n");
+        return 1;
+    }
+    start_color();
+    use_default_colors();
+    init_pair(1, COLOR_WHITE, COLOR_BLUE);
+    init_pair(2, COLOR_BLACK, COLOR_WHITE);
+    init_pair(3, COLOR_RED, COLOR_YELLOW);
+    init_pair(4, COLOR_GREEN, COLOR_RED);
+
+    printf("%-8s %6s %9s %9s %9s %9s %12s %10s  %s\n", "workload", "frames", "p50 us", "p90 us", "p99 us", "max us",
+           "bytes/frame", "writes/fr", "readback");
+
+    bool bFailed = false;
+    auto fnRun = [&](const char *c_strName, const std::function<void(Bench &)> &fnSetup,
+                     const std::function<void(Bench &, int)> &fnStep) {
+        BenchResult brResult = RunWorkload(iFrames, fnSetup, fnStep);
+        Report(c_strName, brResult);
+        bFailed |= brResult.iMismatches != 0;
+    };
+
+    // 16 tiled windows, all redrawn every frame
+    fnRun(
+        "windows",
+        [](Bench &bench) {
+            for (int i = 0; i < 16; i++)
+            {
+                bench.Add(new AWindow(BENCH_LINES / 4, BENCH_COLS / 4, (i / 4) * (BENCH_LINES / 4), (i % 4) * (BENCH_COLS / 4)))
+                    ->BKGDSet(COLOR_PAIR(1 + i % 4));
+            }
+        },
+        [](Bench &bench, int iFrame) {
+            for (std::unique_ptr<AWindow> &p_wndWindow : bench.vec_p_wndWindows)
+            {
+                DrawWindow(p_wndWindow.get(), iFrame);
+            }
+        });
+
+    // the same 16 windows under a static window that covers most of the screen
+    fnRun(
+        "covered",
+        [](Bench &bench) {
+            AWindow *p_wndFront = bench.Add(new AWindow(BENCH_LINES - 4, BENCH_COLS - 8, 2, 4));
+            p_wndFront->BKGDSet(COLOR_PAIR(2));
+            DrawWindow(p_wndFront, 0);
+            for (int i = 0; i < 16; i++)
+            {
+                bench.Add(new AWindow(BENCH_LINES / 4, BENCH_COLS / 4, (i / 4) * (BENCH_LINES / 4), (i % 4) * (BENCH_COLS / 4)))
+                    ->BKGDSet(COLOR_PAIR(1 + i % 4));
+            }
+        },
+        [](Bench &bench, int iFrame) {
+            for (size_t i = 1; i < bench.vec_p_wndWindows.size(); i++)
+            {
+                DrawWindow(bench.vec_p_wndWindows[i].get(), iFrame);
+            }
+        });
+
+    // one window dragged in a circle over three static ones
+    fnRun(
+        "move",
+        [](Bench &bench) {
+            for (int i = 0; i < 4; i++)
+            {
+                AWindow *p_wndWindow = bench.Add(new AWindow(14, 40, 2 + i * 6, 4 + i * 20));
+                p_wndWindow->BKGDSet(COLOR_PAIR(1 + i));
+                DrawWindow(p_wndWindow, 0);
+            }
+        },
+        [](Bench &bench, int iFrame) {
+            AWindow *p_wndWindow = bench.vec_p_wndWindows.front().get();
+            int iStep = iFrame % 80;
+            int x = iStep < 40 ? iStep * 2 : (80 - iStep) * 2;
+            int y = iStep < 40 ? iStep / 2 : (80 - iStep) / 2;
+            p_wndWindow->MoveWindow(y, x);
+            p_wndWindow->Flip();
+        });
+
+    // a full-screen shell pane receiving 16KB of output per frame
+    fnRun(
+        "flood",
+        [](Bench &bench) {
+            ShellWindow *p_wndShell = new ShellWindow(BENCH_LINES, BENCH_COLS, 0, 0, "/bin/true");
+            p_wndShell->Build();
+            p_wndShell->Flip();
+            bench.Add(p_wndShell);
+        },
+        [](Bench &bench, int iFrame) {
+            std::string strChunk = FloodChunk(iFrame, 16384);
+            static_cast<ShellWindow *>(bench.vec_p_wndWindows.front().get())->Feed(strChunk.data(), strChunk.size());
+        });
+
+    // the terminal size changes every frame
+    fnRun(
+        "resize",
+        [](Bench &bench) {
+            for (int i = 0; i < 4; i++)
+            {
+                bench.Add(new AWindow(12, 36, 1 + i * 7, 2 + i * 18))->BKGDSet(COLOR_PAIR(1 + i));
+            }
+        },
+        [](Bench &bench, int iFrame) {
+            bench.Resize(BENCH_LINES - iFrame % 12, BENCH_COLS - (iFrame * 5) % 40);
+            for (std::unique_ptr<AWindow> &p_wndWindow : bench.vec_p_wndWindows)
+            {
+                DrawWindow(p_wndWindow.get(), iFrame);
+            }
+        });
+
+    // a recorded session, one 60 Hz frame of its time per frame; every
+    // recorded pane gets a pty-less shell window of its size
+    if (c_strReplay != nullptr)
+    {
+        std::vector<SessionEvent> vec_seEvents;
+        if (!SessionReader::ReadAll(c_strReplay, &vec_seEvents) || vec_seEvents.empty())
+        {
+            fprintf(stderr, "bench: cannot read session log %s\n", c_strReplay);
+            return 1;
+        }
+
+        std::vector<ShellWindow *> vec_p_wndPanes;
+        size_t u_iNext = 0;
+        int iReplayFrames = static_cast<int>(vec_seEvents.back().i64TimeNs / BENCH_FRAME_NS) + 1;
+        BenchResult brResult = RunWorkload(
+            iReplayFrames,
+            [&](Bench &bench) {
+                for (const SessionEvent &seEvent : vec_seEvents)
+                {
+                    if (seEvent.u8Type != SESSION_PANE)
+                        continue;
+                    // the log has the terminal's size, the window adds the title line
+                    ShellWindow *p_wndPane = new ShellWindow(std::min<int>(seEvent.u32Lines + 1, BENCH_LINES),
+                                                             std::min<int>(seEvent.u32Cols, BENCH_COLS), 0, 0, nullptr, false);
+                    p_wndPane->PinTerminal(seEvent.u32Lines, seEvent.u32Cols);
+                    p_wndPane->Build();
+                    p_wndPane->Flip();
+                    bench.Add(p_wndPane);
+                    vec_p_wndPanes.resize(std::max<size_t>(vec_p_wndPanes.size(), seEvent.u32Pane + 1), nullptr);
+                    vec_p_wndPanes[seEvent.u32Pane] = p_wndPane;
+                }
+            },
+            [&](Bench &, int iFrame) {
+                int64_t i64Until = static_cast<int64_t>(iFrame + 1) * BENCH_FRAME_NS;
+                for (; u_iNext < vec_seEvents.size() && vec_seEvents[u_iNext].i64TimeNs < i64Until; u_iNext++)
+                {
+                    const SessionEvent &seEvent = vec_seEvents[u_iNext];
+                    if (seEvent.u32Pane >= vec_p_wndPanes.size() || vec_p_wndPanes[seEvent.u32Pane] == nullptr)
+                        continue;
+                    if (seEvent.u8Type == SESSION_OUTPUT)
+                        vec_p_wndPanes[seEvent.u32Pane]->Feed(seEvent.strData.data(), seEvent.strData.size());
+                    else if (seEvent.u8Type == SESSION_RESIZE)
+                        vec_p_wndPanes[seEvent.u32Pane]->PinTerminal(seEvent.u32Lines, seEvent.u32Cols);
+                }
+            });
+        Report("replay", brResult);
+        bFailed |= brResult.iMismatches != 0;
+    }
+
+    endwin();
+    delscreen(p_scrScreen);
+    fclose(p_fNull);
+    return bFailed ? 1 : 0;
+}
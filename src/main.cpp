@@ -1,35 +1,70 @@
 #include <ncurses.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <algorithm>
 #include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <deque>
 #include <string>
-#include <thread>
 #include <chrono>
 #include <shared_mutex> // for sync
 
 #include "fps.hpp"
 #include "utils.hpp"
 #include "ncurses_custom.hpp"
+#include "shell_window.hpp"
+#include "reactor.hpp"
+#include "trace.hpp"
+#include "widgets.hpp"
+#include "session_log.hpp"
+#include "remote.hpp"
 #include "defs.hpp"
 
-#define UE_SCREENSIZE_UPDATE 10
+#define KEY_PASTE_BEGIN (KEY_MAX + 1) // ESC[200~, registered with define_key
+#define PASTE_READ_CHUNK 65536
+#define KEY_DETACH 0x1c              // ctrl+\ detaches an attached client
+#define ATTACH_WAIT_MS 3000          // for a server --attach started itself
+#define SHELL_MAX_PANES 64           // --panes
+#define SYNC_TITLE_ATTR (A_BOLD | A_REVERSE | COLOR_PAIR(4)) // title of a pane in the sync group
 
 void ExitHandler();
-void QueueHandler();
-void TimerHandler();
-void MainWindowHandler();
-void InfoWindowHandler();
-void DebugConsoleWindowHandler();
+void WriteHostSequence(const char *c_strSeq);
+void InputHandler();
+bool PumpPaste();
+void DispatchKey(int key);
+void DispatchPaste(std::shared_ptr<std::string> p_strText);
+bool StartServer(const char *c_strPath);
+void RunClient();
+void FlushClient();
+void ResizeHandler();
+void FrameHandler();
+void StartReplay(std::vector<SessionEvent> vec_seEvents, bool bRealTime);
+std::string FormatStatsRow(const char *c_strName, const frame_stats &fsStats);
+HandlerTask MainWindowHandler();
+HandlerTask InfoWindowHandler();
+HandlerTask DebugConsoleWindowHandler();
+HandlerTask ShellWindowHandler(std::string strName);
+ShellWindow *CreateShellPane(const char *c_strName, const char *c_strTitle, bool bSpawn);
 
 // Datas
 WINDOW *p_wndHostWindow = nullptr;
-WINDOW *p_wndHostWindowBuffer = nullptr;
-AWindow *p_awndHostWindow = nullptr;
-AWindow *p_awndHostWindowBuffer = nullptr;
-BlockingQueue<int> bq_iEvents;
-BlockingQueue<int> bq_iUpdateEvents;
+Reactor rctEvents;
+FrameScheduler *p_fsFrames;
+HandlerPool *p_hpHandlers;
 WindowManager *p_wmgrWindows;
-frame_rater<60> frFrameRater;
 frame_counter fcFrameCounter;
 RangeQueue<std::string> strDebugLog{10}; // 10 Lines
+std::shared_ptr<std::string> p_strPaste;  // bracketed paste being read, or nullptr
+SessionRecorder *p_srRecorder = nullptr;  // --record
+SessionReplay *p_srpReplay = nullptr;     // --replay, --replay-max
+uint64_t u64FramesRendered = 0;
+RemoteServer *p_rsServer = nullptr; // --server: panes are shown to attached clients
+RemoteClient *p_rcClient = nullptr; // --attach: this process only shows a server's screen
+ShellSyncGroup sgSync;                // panes typing goes to at once, toggled with F3
+std::deque<std::string> dq_strPaneNames; // window names and titles of the shell panes
+std::string strExitReport; // printed once the screen is released
 
 // Program Main Entry
 int main(int argc, char *argv[])
@@ -37,14 +72,54 @@ int main(int argc, char *argv[])
     // Registers
     atexit(ExitHandler);
 
+    // SIGWINCH is read from a signalfd, so no thread may take it directly
+    Reactor::BlockSignals({SIGWINCH});
+
+    // a server owns the panes without a terminal, a client has nothing but one
+    const char *c_strServerPath = nullptr;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--server") == 0)
+            c_strServerPath = argv[++i];
+        else if (strcmp(argv[i], "--attach") == 0)
+        {
+            p_rcClient = new RemoteClient{};
+            if (!p_rcClient->Connect(argv[++i]) && !StartServer(argv[i]))
+            {
+                fprintf(stderr, "attach: cannot reach or start a server at %s\n", argv[i]);
+                return 1;
+            }
+        }
+    }
+
     // init ncurses
-    p_wndHostWindow = initscr(); // screen
-    raw();                       // raw keyboard input
-    cbreak();                    // for better keyboard processing
-    noecho();                    // for better echo controlling
-    keypad(stdscr, TRUE);        // input processing
-    start_color();               // enable color support
-    curs_set(FALSE);             // hide cursor
+    if (c_strServerPath != nullptr)
+    {
+        // terminfo and color pairs only; the screen size comes from clients
+        FILE *p_fNull = fopen("/dev/null", "r+");
+        const char *c_strTerm = getenv("TERM");
+        set_term(newterm(c_strTerm != nullptr && *c_strTerm ? c_strTerm : "xterm-256color", p_fNull, p_fNull));
+        p_wndHostWindow = stdscr;
+        start_color();
+        use_default_colors();
+    }
+    else
+    {
+        p_wndHostWindow = initscr(); // screen
+        raw();                       // raw keyboard input
+        cbreak();                    // for better keyboard processing
+        noecho();                    // for better echo controlling
+        keypad(stdscr, TRUE);        // input processing
+        nodelay(stdscr, TRUE);       // wgetch only runs when stdin is readable
+        start_color();               // enable color support
+        use_default_colors();        // -1 is the terminal's own color, for shell panes
+        curs_set(FALSE);             // hide cursor
+
+        // pastes arrive between ESC[200~ and ESC[201~; the start marker becomes one
+        // key code and the rest is read in bulk by PumpPaste
+        define_key("\x1b[200~", KEY_PASTE_BEGIN);
+        WriteHostSequence("\x1b[?2004h");
+    }
 
     init_pair(1, COLOR_WHITE, COLOR_BLUE);
     init_pair(2, COLOR_BLACK, COLOR_WHITE);
@@ -53,11 +128,95 @@ int main(int argc, char *argv[])
 
     fcFrameCounter.noUpdateDelay = true;
 
-    p_wndHostWindowBuffer = newwin(COLS, LINES, 0, 0);
-    p_awndHostWindow = new AWindow{p_wndHostWindow};
-    p_awndHostWindowBuffer = new AWindow{p_wndHostWindowBuffer};
+    p_wmgrWindows = new WindowManager{p_wndHostWindow};
+
+    // frames are rendered only when requested, at most 60 per second by default
+    p_fsFrames = new FrameScheduler{rctEvents, 60, FrameHandler};
+    p_wmgrWindows->SetFrameRequest([]() { p_fsFrames->Request(); }, []() { p_fsFrames->RequestNow(); });
+
+    // window handlers are coroutines sharing one worker per core
+    p_hpHandlers = new HandlerPool{};
+    p_wmgrWindows->SetHandlerPool(p_hpHandlers);
+
+    bool bReplay = false, bReplayRealTime = true;
+    int iPanes = 1;
+    std::vector<SessionEvent> vec_seReplay;
+    for (int i = 1; i < argc; i++)
+    {
+        // optional direct tty output
+        if (strcmp(argv[i], "--vt") == 0 && VtBackend::Supported())
+        {
+            p_wmgrWindows->SetBackend(new VtBackend{});
+        }
+        // frame rate cap
+        if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            p_fsFrames->SetRate(atoi(argv[++i]));
+        }
+        // record spans, written as Chrome trace JSON on exit or F12
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            Tracer::Enable(argv[++i]);
+        }
+        // number of shell panes, tiled in a grid
+        if (strcmp(argv[i], "--panes") == 0 && i + 1 < argc)
+        {
+            iPanes = std::clamp(atoi(argv[++i]), 1, SHELL_MAX_PANES);
+        }
+        // log the shell panes' pty traffic
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            p_srRecorder = new SessionRecorder{};
+            if (!p_srRecorder->Open(argv[++i]))
+            {
+                delete p_srRecorder;
+                p_srRecorder = nullptr;
+            }
+        }
+        // play a log back instead of running a shell, as recorded or at full speed
+        if ((strcmp(argv[i], "--replay") == 0 || strcmp(argv[i], "--replay-max") == 0) && i + 1 < argc)
+        {
+            bReplayRealTime = strcmp(argv[i], "--replay") == 0;
+            bReplay = true;
+            if (!SessionReader::ReadAll(argv[++i], &vec_seReplay))
+            {
+                strExitReport = "replay: cannot read the log\n";
+                exit(1);
+            }
+        }
+    }
+
+    // a replay needs a pane for every pane the log was recorded from
+    if (bReplay)
+    {
+        int iLogPanes = static_cast<int>(std::count_if(vec_seReplay.begin(), vec_seReplay.end(), [](const SessionEvent &seEvent) {
+            return seEvent.u8Type == SESSION_PANE;
+        }));
+        iPanes = std::max(iPanes, std::min(iLogPanes, SHELL_MAX_PANES));
+    }
 
-    p_wmgrWindows = new WindowManager{p_awndHostWindow, p_awndHostWindowBuffer};
+    if (p_rcClient != nullptr)
+        RunClient();
+
+    // hand every composed frame to the attached clients instead of a terminal
+    if (c_strServerPath != nullptr)
+    {
+        p_rsServer = new RemoteServer{rctEvents};
+        if (!p_rsServer->Listen(c_strServerPath))
+        {
+            strExitReport = "server: cannot listen on the socket\n";
+            exit(1);
+        }
+        p_rsServer->fnSize = [](int iLines, int iCols) {
+            resize_term(iLines, iCols);
+            if (p_wmgrWindows->NewScreenSize())
+                p_wmgrWindows->UpdateScreenSize();
+        };
+        p_rsServer->fnKey = DispatchKey;
+        p_rsServer->fnPaste = DispatchPaste;
+        p_rsServer->fnRequestFrame = []() { p_wmgrWindows->RequestFrame(); };
+        p_wmgrWindows->SetBackend(p_rsServer);
+    }
 
     // screen check
     if (!has_colors())
@@ -68,101 +227,112 @@ int main(int argc, char *argv[])
 
     //Create Window
     {
-        // Create Main Window
+        // Create Main Window, floating over the tiled ones
         {
             AWindow *p_wndWindow{};
-            p_wndWindow = new AWindow(subwin(p_wndHostWindow, 12, 32, 1, 0));
+            p_wndWindow = new AWindow(12, 32, 1, std::max(COLS - 33, 0));
             p_wndWindow->c_p_strTitle = "Main Window";
             p_wndWindow->bNoFrame = true;
             p_wndWindow->fcWindowReqFrameCounter.noUpdateDelay = true;
             p_wndWindow->BKGDSet(COLOR_PAIR(1));
-            p_wndWindow->ResetBuffer();
             p_wmgrWindows->Add("p_wndMainWindow", p_wndWindow);
         }
         // Create Info Window
         {
             AWindow *p_wndWindow{};
-            p_wndWindow = new AWindow(subwin(p_wndHostWindow, 14, 42, 20, 1));
+            p_wndWindow = new AWindow(14, 42, 20, 1);
             p_wndWindow->c_p_strTitle = "Info Window";
             p_wndWindow->BKGDSet(COLOR_PAIR(3));
-            p_wndWindow->ResetBuffer();
             p_wmgrWindows->Add("p_wndInfoWindow", p_wndWindow);
         }
         // Create Debug Console Window
         {
             AWindow *p_wndWindow{};
-            p_wndWindow = new AWindow(subwin(p_wndHostWindow, 14, 20, 3, 33));
+            p_wndWindow = new AWindow(14, 20, 3, 33);
             p_wndWindow->c_p_strTitle = "Debug Console Window";
             p_wndWindow->BKGDSet(COLOR_PAIR(4));
-            p_wndWindow->ResetBuffer();
             p_wmgrWindows->Add("p_wndDebugConsoleWindow", p_wndWindow);
         }
-    }
-
-    // Start Handlers
-    std::thread QueueHandlerTh(QueueHandler);
-    std::thread TimerHandlerTh(TimerHandler);
-    // Start Windows
-    std::thread MainWindowTh(MainWindowHandler);
-    std::thread InfoWindowTh(InfoWindowHandler);
-    std::thread DebugConsoleWindowTh(DebugConsoleWindowHandler);
-
-    while (1)
-    {
-        // loop start
-        while (!bq_iUpdateEvents.empty())
+        // Create Shell Windows; the first keeps the name sessions were
+        // always recorded under
+        for (int i = 0; i < iPanes; i++)
         {
-            switch (bq_iUpdateEvents.pop())
-            {
-            case UE_SCREENSIZE_UPDATE:
-            {
-                resize_term(LINES, COLS);
-                p_wmgrWindows->UpdateScreenSize();
-                break;
-            }
-            default:
-                break;
-            }
+            dq_strPaneNames.push_back(i == 0 ? "p_wndShellWindow" : "p_wndShellWindow" + std::to_string(i + 1));
+            dq_strPaneNames.push_back(i == 0 ? "Shell" : "Shell " + std::to_string(i + 1));
+            CreateShellPane(dq_strPaneNames[i * 2].c_str(), dq_strPaneNames[i * 2 + 1].c_str(), !bReplay);
         }
 
-        // process input
-        std::queue<unsigned int> keys;
-        while (!bq_iEvents.empty())
-            keys.push(bq_iEvents.pop());
-
-        // update events
+        // Tile the Debug Console down the left, the Shells and below them the
+        // Info Window over the rest; several Shells share a grid
         {
-            p_wmgrWindows->BroadcastMessage(Msg{WM_UPDATE});
-            p_wmgrWindows->BroadcastMessage(Msg{WM_PRESENT});
-
-            AWindow *wndFrontWindow = nullptr; // Get Top Window
-            if (p_wmgrWindows->GetFront(&wndFrontWindow))
+            std::lock_guard<std::mutex> lock(p_wmgrWindows->mtxLayout);
+            LayoutTree *p_ltLayout = p_wmgrWindows->GetLayout();
+
+            LayoutTree::node iRoot = p_ltLayout->AddSplit(LAYOUT_NONE, LAYOUT_COLS);
+            p_ltLayout->AddLeaf(iRoot, p_wmgrWindows->FindWindow("p_wndDebugConsoleWindow"), 0, 0, 20);
+            LayoutTree::node iRight = p_ltLayout->AddSplit(iRoot, LAYOUT_ROWS);
+            if (iPanes == 1)
+                p_ltLayout->AddLeaf(iRight, p_wmgrWindows->FindWindow("p_wndShellWindow"), 1, 5, 20);
+            else
             {
-                for (std::queue<unsigned int> keys_ = keys; !keys_.empty(); keys_.pop())
-                    p_wmgrWindows->SendMessage(wndFrontWindow, Msg{WM_KEY, keys.front()}); // key
+                int iGridCols = static_cast<int>(std::ceil(std::sqrt(iPanes)));
+                LayoutTree::node iGrid = p_ltLayout->AddSplit(iRight, LAYOUT_ROWS, 1, 5, 20);
+                LayoutTree::node iRow = LAYOUT_NONE;
+                for (int i = 0; i < iPanes; i++)
+                {
+                    if (i % iGridCols == 0)
+                        iRow = p_ltLayout->AddSplit(iGrid, LAYOUT_COLS);
+                    p_ltLayout->AddLeaf(iRow, p_wmgrWindows->FindWindow(dq_strPaneNames[i * 2].c_str()), 1, 2, 8);
+                }
             }
+            p_ltLayout->AddLeaf(iRight, p_wmgrWindows->FindWindow("p_wndInfoWindow"), 0, 14, 42);
         }
+        p_wmgrWindows->Relayout();
+    }
 
-        // update windows
-        p_wmgrWindows->PresentWindows();
-
-        // update screen
-        {
-            p_wmgrWindows->Flip();
-            fcFrameCounter.count();
-        }
+    // let ncurses do its initial screen clear now, so a later implicit
+    // refresh from wgetch cannot wipe frames written by another backend
+    refresh();
 
-        // fps control
-        {
-            frFrameRater.sleep();
-        }
+    // Start Windows
+    p_hpHandlers->Spawn(MainWindowHandler());
+    p_hpHandlers->Spawn(InfoWindowHandler());
+    p_hpHandlers->Spawn(DebugConsoleWindowHandler());
+    for (int i = 0; i < iPanes; i++)
+        p_hpHandlers->Spawn(ShellWindowHandler(dq_strPaneNames[i * 2]));
+
+    // Event loop: input, resizes, frame deadlines and pane ptys; a server
+    // takes input and sizes from its clients
+    if (p_rsServer == nullptr)
+    {
+        rctEvents.Add(STDIN_FILENO, EPOLLIN, [](uint32_t) { InputHandler(); });
+        rctEvents.AddSignal(SIGWINCH, [](const signalfd_siginfo &) { ResizeHandler(); });
     }
+    // the statistics windows refresh once a second
+    rctEvents.AddTimer(std::chrono::seconds(1), std::chrono::seconds(1), []() {
+        p_wmgrWindows->BroadcastMessage(Msg{WM_UPDATE});
+        p_wmgrWindows->BroadcastMessage(Msg{WM_PRESENT});
+        if (p_srRecorder != nullptr)
+            p_srRecorder->Flush();
+    });
+    if (bReplay)
+        StartReplay(std::move(vec_seReplay), bReplayRealTime);
+    p_fsFrames->Request();
+    rctEvents.Run();
 
     exit(0);
 }
 
 void ExitHandler()
 {
+    Tracer::Write();
+    if (p_srRecorder != nullptr)
+        p_srRecorder->Close();
+    if (p_rsServer != nullptr)
+        p_rsServer->Close();
+    else
+        WriteHostSequence("\x1b[?2004l");
+
     // release ncurses
 
     nocbreak();
@@ -170,99 +340,422 @@ void ExitHandler()
     keypad(stdscr, FALSE); // = nokeypad()
 
     endwin();
+
+    if (!strExitReport.empty())
+        fputs(strExitReport.c_str(), stderr);
 }
 
-void QueueHandler()
+// Terminal modes ncurses does not know about go straight to the tty
+void WriteHostSequence(const char *c_strSeq)
 {
-    while (1)
-    {
-        int key = wgetch(p_wndHostWindow);
+    ssize_t n = write(STDOUT_FILENO, c_strSeq, strlen(c_strSeq));
+    (void)n;
+}
+
+void InputHandler()
+{
+    if (p_strPaste && !PumpPaste())
+        return;
 
-        switch (key)
+    int key;
+    while ((key = wgetch(p_wndHostWindow)) != ERR)
+    {
+        if (key == KEY_PASTE_BEGIN)
         {
-        default:
-            bq_iEvents.push(key);
-            break;
+            p_strPaste = std::make_shared<std::string>();
+            if (!PumpPaste())
+                return;
+            continue;
         }
+        DispatchKey(key);
     }
 }
 
-void TimerHandler()
+// A key from this terminal or an attached client; an attached client
+// passes its keys on to the server
+void DispatchKey(int key)
 {
-    while (1)
+    if (p_rcClient != nullptr)
     {
-        // TODO: Process in times
-        if (p_wmgrWindows->NewScreenSize())
+        if (key == KEY_DETACH)
         {
-            bq_iUpdateEvents.push(UE_SCREENSIZE_UPDATE);
+            strExitReport = "[detached]\n";
+            exit(0);
         }
+        p_rcClient->SendKey(key);
+        FlushClient();
+        return;
+    }
+
+    // F2 brings the bottom window to the front
+    if (key == KEY_F(2))
+    {
+        const std::vector<AWindow *> *p_vec_p_awndWindows = p_wmgrWindows->GetWindowsList();
+        if (!p_vec_p_awndWindows->empty())
+            p_wmgrWindows->MakeFront(p_vec_p_awndWindows->back());
+        return;
+    }
+    // F12 dumps the trace recorded so far
+    if (key == KEY_F(12))
+    {
+        Tracer::Write();
+        return;
+    }
+
+    AWindow *wndFrontWindow = nullptr; // Get Top Window
+    if (!p_wmgrWindows->GetFront(&wndFrontWindow))
+        return;
+
+    // F3 adds the front shell pane to the sync group or takes it out
+    if (key == KEY_F(3))
+    {
+        ShellWindow *p_wndPane = dynamic_cast<ShellWindow *>(wndFrontWindow);
+        if (p_wndPane != nullptr)
+            p_wmgrWindows->SendMessage(p_wndPane, Msg{WM_SYNC, sgSync.Toggle(p_wndPane) ? 1u : 0u});
+        return;
+    }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(800));
+    // typed into a synced pane, the key goes to all of them with the next frame
+    if (sgSync.Contains(wndFrontWindow) && sgSync.AddKey(static_cast<ShellWindow *>(wndFrontWindow), key))
+    {
+        p_fsFrames->Request();
+        return;
     }
+
+    Msg msgKey{WM_KEY, (unsigned int)key};
+    msgKey.i64StampNs = frame_now_ns(); // for key-to-flip latency
+    p_wmgrWindows->SendMessage(wndFrontWindow, msgKey); // key
 }
 
-void MainWindowHandler()
+void DispatchPaste(std::shared_ptr<std::string> p_strText)
 {
-    AWindow *p_wndMainWindow = nullptr;
-    if (!p_wmgrWindows->GetWindow("p_wndMainWindow", &p_wndMainWindow))
+    if (p_rcClient != nullptr)
+    {
+        p_rcClient->SendPaste(*p_strText);
+        FlushClient();
         return;
+    }
 
-    auto fnDrawGuiLocked = [&]() {
-        p_wndMainWindow->Erase();
-        p_wndMainWindow->Build();
-        p_wndMainWindow->MVPrint(1, 1, "Press 'Enter' to refresh me!");
-        p_wndMainWindow->Flip();
-        p_wndMainWindow->RequestPresent();
-    };
+    AWindow *wndFrontWindow = nullptr;
+    if (!p_wmgrWindows->GetFront(&wndFrontWindow))
+        return;
 
-    fnDrawGuiLocked();
-    while (1)
+    if (sgSync.Contains(wndFrontWindow))
     {
-        Msg msg;
-        p_wndMainWindow->GetMessage(&msg);
+        sgSync.AddPaste(std::move(p_strText));
+        return;
+    }
 
-        static bool c_s_bLocked = true;
-        static bool c_s_bFloatInverter = false;
+    Msg msgPaste{WM_PASTE, std::move(p_strText)};
+    msgPaste.i64StampNs = frame_now_ns();
+    p_wmgrWindows->SendMessage(wndFrontWindow, msgPaste);
+}
 
-        double fScrFps, fWndFps, fWndReqFps;
+// Read the rest of a bracketed paste straight from stdin and send it to the
+// front window as one WM_PASTE; false while the end marker is still to come
+bool PumpPaste()
+{
+    const char c_arrEnd[] = "\x1b[201~";
+    const size_t c_u_iEndSize = sizeof(c_arrEnd) - 1;
+    char arr_chBuffer[PASTE_READ_CHUNK];
 
-        const auto fnUpdateFps = [&]() {
-            fScrFps = fcFrameCounter.fps;
-            fWndFps = p_wndMainWindow->fcWindowFrameCounter.fps;
-            fWndReqFps = p_wndMainWindow->fcWindowReqFrameCounter.fps;
+    int iAvailable = 0;
+    while (ioctl(STDIN_FILENO, FIONREAD, &iAvailable) == 0 && iAvailable > 0)
+    {
+        ssize_t n = read(STDIN_FILENO, arr_chBuffer, std::min<size_t>(iAvailable, sizeof(arr_chBuffer)));
+        if (n <= 0)
+            break;
+
+        // the marker may straddle two reads
+        size_t u_iFrom = p_strPaste->size() >= c_u_iEndSize ? p_strPaste->size() - (c_u_iEndSize - 1) : 0;
+        p_strPaste->append(arr_chBuffer, n);
+        size_t u_iEnd = p_strPaste->find(c_arrEnd, u_iFrom, c_u_iEndSize);
+        if (u_iEnd == std::string::npos)
+            continue;
+
+        // whatever followed the marker is typed input again
+        for (size_t i = p_strPaste->size(); i > u_iEnd + c_u_iEndSize; i--)
+            ungetch(static_cast<unsigned char>((*p_strPaste)[i - 1]));
+        p_strPaste->resize(u_iEnd);
+
+        DispatchPaste(std::move(p_strPaste));
+        p_strPaste.reset();
+        return true;
+    }
+    return false;
+}
+
+// Start a server for c_strPath in its own session, so it outlives this
+// terminal, and connect p_rcClient to it
+bool StartServer(const char *c_strPath)
+{
+    pid_t pidServer = fork();
+    if (pidServer < 0)
+        return false;
+
+    if (pidServer == 0)
+    {
+        setsid();
+        int iNullFd = open("/dev/null", O_RDWR);
+        dup2(iNullFd, STDIN_FILENO);
+        dup2(iNullFd, STDOUT_FILENO);
+        dup2(iNullFd, STDERR_FILENO);
+        if (iNullFd > STDERR_FILENO)
+            close(iNullFd);
+
+        // the server forks again and exits, so nobody has to reap it
+        if (fork() != 0)
+            _exit(0);
+        execl("/proc/self/exe", "MultiShell", "--server", c_strPath, (char *)nullptr);
+        _exit(127);
+    }
+    waitpid(pidServer, nullptr, 0);
+
+    for (int iWaited = 0; iWaited < ATTACH_WAIT_MS; iWaited += 20)
+    {
+        if (p_rcClient->Connect(c_strPath))
+            return true;
+        usleep(20000);
+    }
+    return false;
+}
+
+// An attached client: keys and pastes go to the server, its frames to this
+// terminal. Never returns.
+void RunClient()
+{
+    p_rcClient->SendSize(LINES, COLS);
+    FlushClient();
+
+    rctEvents.Add(STDIN_FILENO, EPOLLIN, [](uint32_t) { InputHandler(); });
+    rctEvents.AddSignal(SIGWINCH, [](const signalfd_siginfo &) {
+        winsize ws{};
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0)
+            return;
+        // the terminal reflowed what it showed; the server answers with a full frame
+        resize_term(ws.ws_row, ws.ws_col);
+        p_wmgrWindows->GetBackend()->Invalidate();
+        p_rcClient->SendSize(ws.ws_row, ws.ws_col);
+        FlushClient();
+    });
+    rctEvents.Add(p_rcClient->iFd, EPOLLIN, [](uint32_t u32Events) {
+        if (u32Events & EPOLLOUT)
+            FlushClient();
+
+        bool bFramed = false;
+        bool bAlive = p_rcClient->Pump(&bFramed);
+        if (bFramed)
+        {
+            p_wmgrWindows->GetBackend()->Present(p_rcClient->cgScreen);
+            p_rcClient->cgScreen.ClearDirty();
+        }
+        if (!bAlive)
+        {
+            strExitReport = "[server exited]\n";
+            exit(0);
+        }
+    });
+
+    refresh();
+    rctEvents.Run();
+    exit(0);
+}
+
+// Send what the server socket takes now, wait for it to take the rest
+void FlushClient()
+{
+    if (!p_rcClient->Flush())
+        return; // the read side notices and exits
+    rctEvents.Modify(p_rcClient->iFd, p_rcClient->Pending() > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+// A shell pane with its pty watched on the event loop
+ShellWindow *CreateShellPane(const char *c_strName, const char *c_strTitle, bool bSpawn)
+{
+    ShellWindow *p_wndWindow = new ShellWindow(16, 60, 2, 10, nullptr, bSpawn);
+    p_wndWindow->c_p_strTitle = c_strTitle;
+    p_wmgrWindows->Add(c_strName, p_wndWindow);
+    if (p_srRecorder != nullptr)
+        p_wndWindow->Record(p_srRecorder, c_strName);
+
+    int iFd = p_wndWindow->iMasterFd;
+    if (iFd >= 0)
+    {
+        p_wndWindow->fnOutputBlocked = [iFd](bool bBlocked) {
+            rctEvents.Modify(iFd, bBlocked ? EPOLLIN | EPOLLOUT : EPOLLIN);
         };
+        rctEvents.Add(iFd, EPOLLIN, [p_wndWindow, iFd](uint32_t u32Events) {
+            if (u32Events & EPOLLOUT)
+                p_wndWindow->FlushOutput();
+            if ((u32Events & ~EPOLLOUT) && !p_wndWindow->Pump())
+                rctEvents.Remove(iFd);
+        });
+    }
+    return p_wndWindow;
+}
 
-        const auto fnDrawGui = [&]() {
-            if (c_s_bLocked)
-            {
-                fnDrawGuiLocked();
-                return;
-            }
+void ResizeHandler()
+{
+    winsize ws{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0 || ws.ws_col == 0)
+        return;
 
-            p_wndMainWindow->Erase();
-            p_wndMainWindow->Build();
-            if (c_s_bFloatInverter)
-            {
-                p_wndMainWindow->MVPrint(1, 0, "Press 'Q' to exit!");
-                p_wndMainWindow->MVPrint(3, 1, "Screen FPS: %d", (int)fScrFps);
-                p_wndMainWindow->MVPrint(4, 1, "Window FPS: %d", (int)fWndFps);
-                p_wndMainWindow->MVPrint(5, 1, "Window Requesting FPS: %d", (int)fWndReqFps);
-                p_wndMainWindow->MVPrint(7, 1, "<AWSD For Moving>");
-                p_wndMainWindow->MVPrint(8, 1, "<F For Float Inverting>");
-            }
+    resize_term(ws.ws_row, ws.ws_col);
+    if (p_wmgrWindows->NewScreenSize())
+        p_wmgrWindows->UpdateScreenSize();
+}
+
+void FrameHandler()
+{
+    // keys typed into the sync group since the last frame, one write per pane
+    sgSync.Flush();
+
+    // update windows
+    p_wmgrWindows->PresentWindows();
+
+    // update screen
+    p_wmgrWindows->Flip();
+    fcFrameCounter.count();
+    ++u64FramesRendered;
+}
+
+// Feed a recorded session into the panes it was recorded from, matched by
+// window name, with each pane's terminal at the size it had when recorded.
+// Input is not replayed: the panes have no pty to take it. A full-speed
+// replay exits when done; either reports its throughput on exit, and the
+// panes it found no window for.
+void StartReplay(std::vector<SessionEvent> vec_seEvents, bool bRealTime)
+{
+    struct ReplayPane
+    {
+        ShellWindow *p_wndPane = nullptr;
+        std::string strName;
+        uint64_t u64Missed = 0; // output bytes without a window to go to
+    };
+    auto p_vec_rpPanes = std::make_shared<std::vector<ReplayPane>>();
+    uint64_t u64FramesBefore = u64FramesRendered;
+
+    const auto fnEvent = [p_vec_rpPanes](const SessionEvent &seEvent) {
+        std::vector<ReplayPane> &vec_rpPanes = *p_vec_rpPanes;
+        if (vec_rpPanes.size() <= seEvent.u32Pane)
+            vec_rpPanes.resize(seEvent.u32Pane + 1);
+        ReplayPane &rpPane = vec_rpPanes[seEvent.u32Pane];
+
+        if (seEvent.u8Type == SESSION_PANE)
+        {
+            AWindow *p_wndWindow = nullptr;
+            p_wmgrWindows->GetWindow(seEvent.strData.c_str(), &p_wndWindow);
+            rpPane.p_wndPane = dynamic_cast<ShellWindow *>(p_wndWindow);
+            rpPane.strName = seEvent.strData;
+        }
+
+        if (rpPane.p_wndPane == nullptr)
+        {
+            if (seEvent.u8Type == SESSION_OUTPUT)
+                rpPane.u64Missed += seEvent.strData.size();
+            return;
+        }
+
+        if (seEvent.u8Type == SESSION_PANE || seEvent.u8Type == SESSION_RESIZE)
+            rpPane.p_wndPane->PinTerminal(seEvent.u32Lines, seEvent.u32Cols);
+        else if (seEvent.u8Type == SESSION_OUTPUT)
+        {
+            rpPane.p_wndPane->Feed(seEvent.strData.data(), seEvent.strData.size());
+            rpPane.p_wndPane->RequestFrame();
+        }
+    };
+
+    const auto fnDone = [bRealTime, u64FramesBefore, p_vec_rpPanes]() {
+        double fSeconds = p_srpReplay->i64ElapsedNs / 1e9;
+        FormatBuffer fbReport;
+        FormatTo<"replay: {} bytes in {:.3f} s, {:.1f} MB/s, {} frames\n">(
+            fbReport, p_srpReplay->u64Bytes, fSeconds, fSeconds > 0 ? p_srpReplay->u64Bytes / fSeconds / 1e6 : 0.0,
+            u64FramesRendered - u64FramesBefore);
+        strExitReport.assign(fbReport.arr_chData, fbReport.u_iSize);
+        for (size_t i = 0; i < p_vec_rpPanes->size(); i++)
+        {
+            const ReplayPane &rpPane = (*p_vec_rpPanes)[i];
+            if (rpPane.p_wndPane != nullptr)
+                continue;
+
+            FormatTo<"replay: no window for pane {} \"{}\", {} bytes of its output not shown\n">(
+                fbReport, i, rpPane.strName, rpPane.u64Missed);
+            strExitReport.append(fbReport.arr_chData, fbReport.u_iSize);
+        }
+
+        if (!bRealTime)
+            exit(0);
+    };
+
+    p_srpReplay = new SessionReplay{rctEvents, std::move(vec_seEvents), bRealTime, fnEvent, fnDone};
+}
+
+HandlerTask MainWindowHandler()
+{
+    AWindow *p_wndMainWindow = nullptr;
+    if (!p_wmgrWindows->GetWindow("p_wndMainWindow", &p_wndMainWindow))
+        co_return;
+
+    bool bLocked = true;
+    bool bFloatInverter = false;
+
+    WidgetLayer wlWidgets;
+    ValueField<"{}", int> *arr_p_vfIntFps[3] = {};
+    ValueField<"{:f}", double> *arr_p_vfFloatFps[3] = {};
+
+    // the layout only changes with the mode, the values are updated in place
+    const auto fnBuildWidgets = [&]() {
+        wlWidgets.Clear();
+        wlWidgets.Add<TitleBar>();
+        std::fill_n(arr_p_vfIntFps, 3, nullptr);
+        std::fill_n(arr_p_vfFloatFps, 3, nullptr);
+
+        if (bLocked)
+        {
+            wlWidgets.Add<Label>(1, 1, "Press 'Enter' to refresh me!");
+            return;
+        }
+
+        const char *c_arrLabels[3] = {"Screen FPS: ", "Window FPS: ", "Window Requesting FPS: "};
+        wlWidgets.Add<Label>(1, 0, "Press 'Q' to exit!");
+        for (int i = 0; i < 3; i++)
+        {
+            int x = 1 + static_cast<int>(strlen(c_arrLabels[i]));
+            wlWidgets.Add<Label>(3 + i, 1, c_arrLabels[i]);
+            if (bFloatInverter)
+                arr_p_vfIntFps[i] = wlWidgets.Add<ValueField<"{}", int>>(3 + i, x);
             else
-            {
-                p_wndMainWindow->MVPrint(1, 0, "Press 'Q' to exit!");
-                p_wndMainWindow->MVPrint(3, 1, "Screen FPS: %f", fScrFps);
-                p_wndMainWindow->MVPrint(4, 1, "Window FPS: %f", fWndFps);
-                p_wndMainWindow->MVPrint(5, 1, "Window Requesting FPS: %f", fWndReqFps);
-                p_wndMainWindow->MVPrint(7, 1, "<AWSD For Moving>");
-                p_wndMainWindow->MVPrint(8, 1, "<F For Float Inverting>");
-            }
+                arr_p_vfFloatFps[i] = wlWidgets.Add<ValueField<"{:f}", double>>(3 + i, x);
+        }
+        wlWidgets.Add<Label>(7, 1, "<AWSD For Moving>");
+        wlWidgets.Add<Label>(8, 1, "<F For Float Inverting>");
+    };
 
-            p_wndMainWindow->Flip();
-            p_wndMainWindow->RequestPresent(); // Let Screen Present
-        };
+    const auto fnUpdateFps = [&]() {
+        double arr_fFps[3] = {fcFrameCounter.fps, p_wndMainWindow->fcWindowFrameCounter.fps,
+                              p_wndMainWindow->fcWindowReqFrameCounter.fps};
+        for (int i = 0; i < 3; i++)
+        {
+            if (arr_p_vfIntFps[i] != nullptr)
+                arr_p_vfIntFps[i]->Set(static_cast<int>(arr_fFps[i]));
+            if (arr_p_vfFloatFps[i] != nullptr)
+                arr_p_vfFloatFps[i]->Set(arr_fFps[i]);
+        }
+    };
+
+    // a move has to be presented even when no widget changed
+    const auto fnDrawGui = [&]() {
+        wlWidgets.Draw(p_wndMainWindow);
+        p_wndMainWindow->Flip();
+        p_wndMainWindow->RequestPresent(); // Let Screen Present
+    };
+
+    fnBuildWidgets();
+    fnDrawGui();
+    while (1)
+    {
+        Msg msg = co_await p_wndMainWindow->NextMessage();
+        TraceSpan tsSpan(p_wndMainWindow->c_p_strTitle, "handler");
 
         switch (msg.u_iMessage)
         {
@@ -279,8 +772,10 @@ void MainWindowHandler()
 
             if (key == 'F' || key == 'f')
             {
-                c_s_bFloatInverter = !c_s_bFloatInverter;
+                bFloatInverter = !bFloatInverter;
 
+                fnBuildWidgets();
+                fnUpdateFps();
                 fnDrawGui();
             }
 
@@ -322,8 +817,11 @@ void MainWindowHandler()
 
             if (key == '\n')
             {
-                if (c_s_bLocked)
-                    c_s_bLocked = false;
+                if (bLocked)
+                {
+                    bLocked = false;
+                    fnBuildWidgets();
+                }
 
                 fnUpdateFps();
                 fnDrawGui();
@@ -346,109 +844,310 @@ void MainWindowHandler()
     }
 }
 
-void InfoWindowHandler()
+HandlerTask InfoWindowHandler()
 {
     AWindow *p_wndInfoWindow = nullptr;
     if (!p_wmgrWindows->GetWindow("p_wndInfoWindow", &p_wndInfoWindow))
-        return;
+        co_return;
 
     p_wndInfoWindow->fcWindowFrameCounter.noUpdateDelay = true;
     p_wndInfoWindow->fcWindowReqFrameCounter.noUpdateDelay = true;
 
-    frame_rater<60> frFpsLimiter;
-
-    double fScrFps, fWndFps, fWndReqFps;
+    frame_histogram::cursor curDraw, curCompose, curFlip, curInput;
+    frame_stats fsInput{}; // the last second that had keys
+
+    WidgetLayer wlWidgets;
+    ValueField<"{:f}", double> *p_vfScrFps = nullptr, *p_vfWndFps = nullptr, *p_vfWndReqFps = nullptr;
+    List *p_lstPhases = nullptr;
+
+    // the phase list spans the window, so it follows the layout
+    const auto fnBuildWidgets = [&]() {
+        wlWidgets.Clear();
+        wlWidgets.Add<TitleBar>();
+        wlWidgets.Add<Label>(2, 1, "Screen FPS: ");
+        wlWidgets.Add<Label>(3, 1, "Window FPS: ");
+        wlWidgets.Add<Label>(4, 1, "Window Requesting FPS: ");
+        wlWidgets.Add<Label>(6, 1, "phase us      p50    p95    p99     max");
+        p_vfScrFps = wlWidgets.Add<ValueField<"{:f}", double>>(2, 13);
+        p_vfWndFps = wlWidgets.Add<ValueField<"{:f}", double>>(3, 13);
+        p_vfWndReqFps = wlWidgets.Add<ValueField<"{:f}", double>>(4, 24);
+        p_lstPhases = wlWidgets.Add<List>(7, 1, std::max(p_wndInfoWindow->iCols - 2, 0), 4);
+        p_lstPhases->SetRow(3, FormatStatsRow("key>flip", fsInput));
+    };
+    fnBuildWidgets();
 
     const auto fnUpdateFps = [&]() {
-        fScrFps = fcFrameCounter.fps;
-        fWndFps = p_wndInfoWindow->fcWindowFrameCounter.fps;
-        fWndReqFps = p_wndInfoWindow->fcWindowReqFrameCounter.fps;
+        p_vfScrFps->Set(fcFrameCounter.fps);
+        p_vfWndFps->Set(p_wndInfoWindow->fcWindowFrameCounter.fps);
+        p_vfWndReqFps->Set(p_wndInfoWindow->fcWindowReqFrameCounter.fps);
+
+        // compositor phases since the previous redraw
+        p_lstPhases->SetRow(0, FormatStatsRow("draw", p_wmgrWindows->fhDraw.collect(curDraw)));
+        p_lstPhases->SetRow(1, FormatStatsRow("compose", p_wmgrWindows->fhCompose.collect(curCompose)));
+        p_lstPhases->SetRow(2, FormatStatsRow("flip", p_wmgrWindows->fhFlip.collect(curFlip)));
+
+        // keys are sparse, keep showing the last second that had any
+        frame_stats fsCollected = p_wmgrWindows->fhInput.collect(curInput);
+        if (fsCollected.count > 0)
+        {
+            fsInput = fsCollected;
+            p_lstPhases->SetRow(3, FormatStatsRow("key>flip", fsInput));
+        }
     };
 
     const auto fnDrawGui = [&]() {
-
-        p_wndInfoWindow->Erase();
-        p_wndInfoWindow->Build();
-        p_wndInfoWindow->MVPrint(2, 1, "Screen FPS: %f", fScrFps);
-        p_wndInfoWindow->MVPrint(3, 1, "Window FPS: %f", fWndFps);
-        p_wndInfoWindow->MVPrint(4, 1, "Window Requesting FPS: %f", fWndReqFps);
+        if (!wlWidgets.Draw(p_wndInfoWindow))
+            return;
 
         p_wndInfoWindow->Flip();
         p_wndInfoWindow->RequestPresent(); // Let Screen Present
     };
 
+    fnUpdateFps();
+    fnDrawGui();
     while (1)
     {
-        Msg msg;
-        if (!p_wndInfoWindow->MessageEmpty())
+        Msg msg = co_await p_wndInfoWindow->NextMessage();
+        TraceSpan tsSpan(p_wndInfoWindow->c_p_strTitle, "handler");
+
+        switch (msg.u_iMessage)
         {
-            p_wndInfoWindow->GetMessage(&msg);
+        case WM_LAYOUT:
+            if (!p_wndInfoWindow->ApplyLayout())
+                break;
+            fnBuildWidgets();
+            [[fallthrough]];
 
-            switch (msg.u_iMessage)
-            {
-            default:
+        case WM_PRESENT:
+        case WM_SCREEN_RESIZE:
+        case WM_SHOWN:
+        {
+            // nothing to show while covered, WM_SHOWN catches up
+            if (p_wndInfoWindow->bHidden)
                 break;
-            }
-        }
 
-        fnUpdateFps();
-        fnDrawGui();
+            fnUpdateFps();
+            fnDrawGui();
+            break;
+        }
 
-        frFpsLimiter.sleep();
+        default:
+            break;
+        }
 
         continue;
     }
 }
 
-void DebugConsoleWindowHandler()
+HandlerTask DebugConsoleWindowHandler()
 {
     AWindow *p_wndDebugConsoleWindow = nullptr;
     if (!p_wmgrWindows->GetWindow("p_wndDebugConsoleWindow", &p_wndDebugConsoleWindow))
-        return;
+        co_return;
 
-    while (1)
+    std::map<AWindow *, frame_histogram::cursor> map_curUpdate, map_curDraw;
+    std::vector<std::string> vec_strRows;
+
+    // per shell pane: counters and time at the last redraw, and the rates since
+    struct PaneRate
     {
-        Msg msg;
-        p_wndDebugConsoleWindow->GetMessage(&msg);
+        uint64_t u64Bytes = 0, u64Skipped = 0;
+        int64_t i64SampleNs = 0;
+        double dKBps = 0, dSkipsPs = 0;
+    };
+    std::map<AWindow *, PaneRate> map_prPanes;
+
+    WidgetLayer wlWidgets;
+    ValueField<"{:f}", double> *p_vfScrFps = nullptr;
+    List *p_lstWindows = nullptr;
+
+    // the window list fills the window, so it follows the layout
+    const auto fnBuildWidgets = [&]() {
+        wlWidgets.Clear();
+        wlWidgets.Add<TitleBar>();
+        wlWidgets.Add<Label>(1, 0, "Screen FPS:");
+        wlWidgets.Add<Label>(3, 0, "p99 us upd/draw:");
+        p_vfScrFps = wlWidgets.Add<ValueField<"{:f}", double>>(2, 0);
+        p_lstWindows =
+            wlWidgets.Add<List>(4, 0, p_wndDebugConsoleWindow->iCols, std::max(p_wndDebugConsoleWindow->iLines - 4, 0));
+    };
+    fnBuildWidgets();
 
-        double fScrFps, fWndFps, fWndReqFps;
+    while (1)
+    {
+        Msg msg = co_await p_wndDebugConsoleWindow->NextMessage();
 
         const auto fnUpdateFps = [&]() {
-            fScrFps = fcFrameCounter.fps;
-            fWndFps = p_wndDebugConsoleWindow->fcWindowFrameCounter.fps;
-            fWndReqFps = p_wndDebugConsoleWindow->fcWindowReqFrameCounter.fps;
+            p_vfScrFps->Set(fcFrameCounter.fps);
+
+            // every window's update and draw p99 since the previous redraw
+            p_wmgrWindows->Lock();
+            std::vector<AWindow *> vec_p_wndWindows = *p_wmgrWindows->GetWindowsList();
+            p_wmgrWindows->Unlock();
+
+            vec_strRows.clear();
+            for (AWindow *p_wndWindow : vec_p_wndWindows)
+            {
+                frame_stats fsUpdate = p_wndWindow->fhUpdate.collect(map_curUpdate[p_wndWindow]);
+                frame_stats fsDraw = p_wndWindow->fhDraw.collect(map_curDraw[p_wndWindow]);
+
+                FormatBuffer fbRow;
+                FormatTo<"{:6.6}{:6.0f}/{:<6.0f}">(fbRow, p_wndWindow->c_p_strTitle, fsUpdate.p99, fsDraw.p99);
+                vec_strRows.emplace_back(fbRow.arr_chData, fbRow.u_iSize);
+            }
+
+            // how fast each shell pane parses output, and how many of its
+            // screens were replaced before a frame showed them
+            int64_t i64Now = frame_now_ns();
+            bool bHeader = false;
+            for (AWindow *p_wndWindow : vec_p_wndWindows)
+            {
+                ShellWindow *p_wndPane = dynamic_cast<ShellWindow *>(p_wndWindow);
+                if (p_wndPane == nullptr)
+                    continue;
+
+                PaneRate &prPane = map_prPanes[p_wndWindow];
+                uint64_t u64Bytes = p_wndPane->u64BytesParsed.load(std::memory_order_relaxed);
+                uint64_t u64Skipped = p_wndPane->u64ScreensSkipped.load(std::memory_order_relaxed);
+                int64_t i64Elapsed = i64Now - prPane.i64SampleNs;
+                if (prPane.i64SampleNs == 0 || i64Elapsed >= 250000000) // shorter samples are noise
+                {
+                    double dSeconds = prPane.i64SampleNs == 0 ? 0 : i64Elapsed / 1e9;
+                    prPane.dKBps = dSeconds > 0 ? (u64Bytes - prPane.u64Bytes) / 1024.0 / dSeconds : 0;
+                    prPane.dSkipsPs = dSeconds > 0 ? (u64Skipped - prPane.u64Skipped) / dSeconds : 0;
+                    prPane.u64Bytes = u64Bytes;
+                    prPane.u64Skipped = u64Skipped;
+                    prPane.i64SampleNs = i64Now;
+                }
+
+                if (!bHeader)
+                {
+                    vec_strRows.emplace_back("pane     kB/s skip/s");
+                    bHeader = true;
+                }
+                FormatBuffer fbRow;
+                FormatTo<"{:7.7}{:6.0f}{:7.0f}">(fbRow, p_wndWindow->c_p_strTitle, prPane.dKBps, prPane.dSkipsPs);
+                vec_strRows.emplace_back(fbRow.arr_chData, fbRow.u_iSize);
+            }
+            p_lstWindows->SetItems(vec_strRows);
         };
 
         const auto fnDrawGui = [&]() {
-
-            p_wndDebugConsoleWindow->Erase();
-            p_wndDebugConsoleWindow->Build();
-            p_wndDebugConsoleWindow->Move(1, 0);
-            p_wndDebugConsoleWindow->Print("Screen FPS:\n%f\n", fScrFps);
-            p_wndDebugConsoleWindow->Print("Window FPS:\n%f\n", fWndFps);
-            p_wndDebugConsoleWindow->Print("Window Requesting FPS:\n%f\n", fWndReqFps);
+            if (!wlWidgets.Draw(p_wndDebugConsoleWindow))
+                return;
 
             p_wndDebugConsoleWindow->Flip();
             p_wndDebugConsoleWindow->RequestPresent(); // Let Screen Present
         };
 
+        // one redraw per drained batch, however many messages asked for it
+        bool bPresent = false;
+        {
+            TraceSpan tsSpan(p_wndDebugConsoleWindow->c_p_strTitle, "handler");
+            do
+            {
+                switch (msg.u_iMessage)
+                {
+                case WM_UPDATE:
+                    break;
+
+                case WM_LAYOUT:
+                    if (p_wndDebugConsoleWindow->ApplyLayout())
+                    {
+                        fnBuildWidgets();
+                        bPresent = true;
+                    }
+                    break;
+
+                case WM_PRESENT:
+                case WM_SHOWN:
+                    bPresent = true;
+                    break;
+
+                default:
+                    break;
+                }
+            } while (p_wndDebugConsoleWindow->PeekMessage(&msg, false));
+
+            // nothing to show while covered, WM_SHOWN catches up
+            if (p_wndDebugConsoleWindow->bHidden)
+                bPresent = false;
+
+            if (bPresent)
+            {
+                fnUpdateFps();
+                fnDrawGui();
+            }
+        }
+
+        // and no more than one redraw per composited frame
+        if (bPresent)
+            co_await p_wndDebugConsoleWindow->NextFrame();
+
+        continue;
+    }
+}
+
+HandlerTask ShellWindowHandler(std::string strName)
+{
+    ShellWindow *p_wndShellWindow = nullptr;
+    {
+        AWindow *p_awndWindow = nullptr;
+        if (!p_wmgrWindows->GetWindow(strName.c_str(), &p_awndWindow))
+            co_return;
+        p_wndShellWindow = static_cast<ShellWindow *>(p_awndWindow);
+    }
+    const int iTitleAttr = p_wndShellWindow->i_title_attr;
+
+    p_wndShellWindow->Build();
+    p_wndShellWindow->Flip();
+    p_wndShellWindow->RequestPresent();
+
+    while (1)
+    {
+        Msg msg = co_await p_wndShellWindow->NextMessage();
+        TraceSpan tsSpan(p_wndShellWindow->c_p_strTitle, "handler");
+
         switch (msg.u_iMessage)
         {
-        case WM_UPDATE:
+        case WM_KEY:
+            p_wndShellWindow->SendKey(msg.u_iParam);
             break;
 
-        case WM_PRESENT:
-        {
-            fnUpdateFps();
-            fnDrawGui();
+        case WM_PASTE:
+            p_wndShellWindow->SendPaste(*msg.p_strData);
+            break;
+
+        // a synced pane shows it in its title bar
+        case WM_SYNC:
+            p_wndShellWindow->i_title_attr = msg.u_iParam ? SYNC_TITLE_ATTR : iTitleAttr;
+            p_wndShellWindow->Build();
+            p_wndShellWindow->Flip();
+            p_wndShellWindow->RequestPresent();
+            break;
 
+        case WM_LAYOUT:
+            if (!p_wndShellWindow->ApplyLayout())
+                break;
+            [[fallthrough]];
+
+        case WM_SCREEN_RESIZE:
+        {
+            p_wndShellWindow->Build();
+            p_wndShellWindow->Flip();
+            p_wndShellWindow->RequestPresent();
             break;
         }
 
         default:
             break;
         }
-
-        continue;
     }
 }
+
+std::string FormatStatsRow(const char *c_strName, const frame_stats &fsStats)
+{
+    FormatBuffer fbRow;
+    FormatTo<"{:<10}{:7.1f}{:7.1f}{:7.1f}{:8.1f}">(fbRow, c_strName, fsStats.p50, fsStats.p95, fsStats.p99, fsStats.max);
+    return std::string(fbRow.arr_chData, fbRow.u_iSize);
+}